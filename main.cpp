@@ -12,6 +12,831 @@
 #include <limits>
 #include <random>
 #include <chrono>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <fstream>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <thread>
+#include <sstream>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <string_view>
+#include <span>
+#include <bitset>
+#include <future>
+#include <condition_variable>
+#include <optional>
+#include <queue>
+#include <string>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <utility>
+#include <charconv>
+#include <coroutine>
+#include <latch>
+#include <semaphore>
+#include <fcntl.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/ioctl.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Work-stealing task scheduler shared by the Parallel helpers and the
+// session coroutines. ShardedProductManager is the exception: each shard
+// keeps the thread that owns it, and when a shard calls into the Parallel
+// helpers it waits on this pool from outside like any other caller. Every
+// worker owns a Chase-Lev deque: it pushes and pops fork-join jobs at the
+// bottom while idle workers steal the oldest jobs from the top. Jobs queued
+// from outside the pool (or for later, like resumed sessions) go through a
+// FIFO injection queue. Workers start on first use; configure() picks the
+// thread count and CPU affinity, otherwise TASK_THREADS, TASK_AFFINITY
+// (none, compact or scatter) and TASK_NUMA_NODE are read from the
+// environment.
+class TaskScheduler {
+
+    public:
+    enum class Affinity {
+        NONE,
+        // Fill the CPUs of one NUMA node before moving to the next.
+        COMPACT,
+        // Spread workers round-robin over the NUMA nodes.
+        SCATTER
+    };
+
+    struct Options {
+        unsigned int threads = 0;
+        Affinity affinity = Affinity::NONE;
+        // Only use the CPUs of this node; -1 uses every node.
+        int numaNode = -1;
+    };
+
+    struct Stats {
+        uint64_t spawned = 0;
+        uint64_t executed = 0;
+        uint64_t stolen = 0;
+        uint64_t stealAttempts = 0;
+        uint64_t injected = 0;
+    };
+
+    // Jobs are owned by whoever hands them to the scheduler and are never
+    // copied, so they can live on the stack of a fork-join frame or inside a
+    // suspended coroutine.
+    struct Job {
+        void (*execute)(Job*) = nullptr;
+        std::atomic<bool> finished { false };
+        bool detached = false;
+        // Set by run() for a caller outside the pool; released once the job
+        // has run, as the scheduler's last access to the job's frame.
+        std::binary_semaphore* done = nullptr;
+    };
+
+    TaskScheduler() {
+        m_Started = false;
+        m_Configured = false;
+        m_Stopping = false;
+    }
+
+    ~TaskScheduler() {
+        stop();
+    }
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    // Stops the workers if they are running; the next parallel call starts
+    // them again with these options. Only call while the pool is idle.
+    void configure(const Options& options) {
+        stop();
+        std::lock_guard<std::mutex> lock(m_StartMutex);
+        m_Options = options;
+        m_Configured = true;
+    }
+
+    unsigned int getThreadCount() {
+        start();
+        return (unsigned int)m_Workers.size();
+    }
+
+    bool onWorker() const {
+        return t_Scheduler == this;
+    }
+
+    // Fork: pushes the job onto the calling worker's deque.
+    void spawn(Job& job) {
+        Worker& self = *t_Worker;
+        self.deque.push(&job);
+        self.spawned.fetch_add(1, std::memory_order_relaxed);
+
+        // Pairs with the fence in idle(): either the sleeper sees the job or
+        // we see the sleeper.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_Sleeping.load(std::memory_order_relaxed) > 0) {
+            wake();
+        }
+    }
+
+    // Join: waits for a job this worker spawned. If nobody stole it, it runs
+    // inline; otherwise the worker steals other jobs until it finishes.
+    void join(Job& job) {
+        Worker& self = *t_Worker;
+        if (!job.finished.load(std::memory_order_acquire)) {
+            if (Job* top = self.deque.take()) {
+                execute(self, top);
+            }
+        }
+
+        while (!job.finished.load(std::memory_order_acquire)) {
+            if (Job* other = steal(self)) {
+                execute(self, other);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // Runs the job on the pool and waits for it. On a worker it runs inline.
+    void run(Job& job) {
+        if (onWorker()) {
+            execute(*t_Worker, &job);
+            return;
+        }
+
+        std::binary_semaphore done(0);
+        job.done = &done;
+        inject(job);
+        done.acquire();
+    }
+
+    // Queues the job behind earlier submissions; nobody waits for it and it
+    // may free itself while running.
+    void submit(Job& job) {
+        job.detached = true;
+        inject(job);
+    }
+
+    // co_await g_TaskScheduler.schedule() continues a coroutine on the pool.
+    auto schedule() {
+        struct Awaiter : Job {
+            TaskScheduler& scheduler;
+            std::coroutine_handle<> handle;
+
+            explicit Awaiter(TaskScheduler& owner) : scheduler(owner) {
+                execute = [](Job* job) {
+                    static_cast<Awaiter*>(job)->handle.resume();
+                };
+            }
+
+            bool await_ready() {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> suspended) {
+                handle = suspended;
+                scheduler.submit(*this);
+            }
+
+            void await_resume() {
+            }
+        };
+        return Awaiter(*this);
+    }
+
+    Stats getStats() const {
+        Stats stats;
+        for (const std::unique_ptr<Worker>& worker : m_Workers) {
+            stats.spawned += worker->spawned.load(std::memory_order_relaxed);
+            stats.executed += worker->executed.load(std::memory_order_relaxed);
+            stats.stolen += worker->stolen.load(std::memory_order_relaxed);
+            stats.stealAttempts += worker->stealAttempts.load(std::memory_order_relaxed);
+        }
+        stats.injected = m_Injected.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    void resetStats() {
+        for (const std::unique_ptr<Worker>& worker : m_Workers) {
+            worker->spawned = 0;
+            worker->executed = 0;
+            worker->stolen = 0;
+            worker->stealAttempts = 0;
+        }
+        m_Injected = 0;
+    }
+
+    private:
+    // Chase-Lev deque with the C11 orderings from Le et al., "Correct and
+    // Efficient Work-Stealing for Weak Memory Models" (PPoPP 2013). Only the
+    // owner pushes and takes; anyone may steal. Arrays replaced by growth are
+    // kept until the deque dies since a thief may still be reading one.
+    class WorkDeque {
+
+        public:
+        WorkDeque() {
+            m_Arrays.push_back(std::make_unique<Array>(256));
+            m_Array.store(m_Arrays.back().get(), std::memory_order_relaxed);
+        }
+
+        void push(Job* job) {
+            int64_t bottom = m_Bottom.load(std::memory_order_relaxed);
+            int64_t top = m_Top.load(std::memory_order_acquire);
+            Array* array = m_Array.load(std::memory_order_relaxed);
+            if (bottom - top > array->mask) {
+                array = grow(array, top, bottom);
+            }
+            array->put(bottom, job);
+            m_Bottom.store(bottom + 1, std::memory_order_release);
+        }
+
+        Job* take() {
+            int64_t bottom = m_Bottom.load(std::memory_order_relaxed) - 1;
+            Array* array = m_Array.load(std::memory_order_relaxed);
+            m_Bottom.store(bottom, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t top = m_Top.load(std::memory_order_relaxed);
+
+            if (top > bottom) {
+                m_Bottom.store(bottom + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+
+            Job* job = array->get(bottom);
+            if (top == bottom) {
+                // Last job: race the thieves for it.
+                if (!m_Top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                    job = nullptr;
+                }
+                m_Bottom.store(bottom + 1, std::memory_order_relaxed);
+            }
+            return job;
+        }
+
+        Job* steal() {
+            int64_t top = m_Top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t bottom = m_Bottom.load(std::memory_order_acquire);
+            if (top >= bottom) {
+                return nullptr;
+            }
+
+            Job* job = m_Array.load(std::memory_order_acquire)->get(top);
+            if (!m_Top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                return nullptr;
+            }
+            return job;
+        }
+
+        bool empty() const {
+            return m_Bottom.load(std::memory_order_acquire) <= m_Top.load(std::memory_order_acquire);
+        }
+
+        private:
+        struct Array {
+            explicit Array(int64_t capacity) : mask(capacity - 1), slots(new std::atomic<Job*>[capacity]) {
+            }
+
+            Job* get(int64_t index) const {
+                return slots[index & mask].load(std::memory_order_relaxed);
+            }
+
+            void put(int64_t index, Job* job) {
+                slots[index & mask].store(job, std::memory_order_relaxed);
+            }
+
+            int64_t mask;
+            std::unique_ptr<std::atomic<Job*>[]> slots;
+        };
+
+        Array* grow(Array* array, int64_t top, int64_t bottom) {
+            m_Arrays.push_back(std::make_unique<Array>((array->mask + 1) * 2));
+            Array* bigger = m_Arrays.back().get();
+            for (int64_t i = top; i < bottom; i++) {
+                bigger->put(i, array->get(i));
+            }
+            m_Array.store(bigger, std::memory_order_release);
+            return bigger;
+        }
+
+        alignas(64) std::atomic<int64_t> m_Top { 0 };
+        alignas(64) std::atomic<int64_t> m_Bottom { 0 };
+        std::atomic<Array*> m_Array;
+        std::vector<std::unique_ptr<Array>> m_Arrays;
+    };
+
+    struct alignas(64) Worker {
+        WorkDeque deque;
+        std::thread thread;
+        // Steal order: workers on the same NUMA node first.
+        std::vector<Worker*> victims;
+        int node = 0;
+        std::vector<int> cpus;
+        std::atomic<uint64_t> spawned { 0 };
+        std::atomic<uint64_t> executed { 0 };
+        std::atomic<uint64_t> stolen { 0 };
+        std::atomic<uint64_t> stealAttempts { 0 };
+    };
+
+    void start() {
+        if (m_Started.load(std::memory_order_acquire)) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_StartMutex);
+        if (m_Started.load(std::memory_order_relaxed)) {
+            return;
+        }
+        if (!m_Configured) {
+            m_Options = OptionsFromEnvironment();
+        }
+
+        unsigned int threads = m_Options.threads ? m_Options.threads : std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::vector<int>> nodes = NumaNodes();
+        if (m_Options.numaNode >= 0 && m_Options.numaNode < (int)nodes.size()) {
+            std::vector<int> only = nodes[m_Options.numaNode];
+            nodes.assign(1, only);
+        }
+
+        m_Stopping = false;
+        m_Workers.clear();
+        for (unsigned int i = 0; i < threads; i++) {
+            m_Workers.push_back(std::make_unique<Worker>());
+            Worker& worker = *m_Workers.back();
+            place(worker, i, nodes);
+        }
+
+        for (size_t i = 0; i < m_Workers.size(); i++) {
+            Worker& worker = *m_Workers[i];
+            for (size_t offset = 1; offset < m_Workers.size(); offset++) {
+                worker.victims.push_back(m_Workers[(i + offset) % m_Workers.size()].get());
+            }
+            std::stable_partition(worker.victims.begin(), worker.victims.end(), [&worker](Worker* victim) {
+                return victim->node == worker.node;
+            });
+        }
+
+        for (std::unique_ptr<Worker>& worker : m_Workers) {
+            Worker* owner = worker.get();
+            worker->thread = std::thread([this, owner]() {
+                loop(*owner);
+            });
+            pin(*worker);
+        }
+
+        m_Started.store(true, std::memory_order_release);
+    }
+
+    void stop() {
+        std::lock_guard<std::mutex> lock(m_StartMutex);
+        if (!m_Started.load(std::memory_order_relaxed)) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> idleLock(m_IdleMutex);
+            m_Stopping = true;
+        }
+        m_Idle.notify_all();
+        for (std::unique_ptr<Worker>& worker : m_Workers) {
+            worker->thread.join();
+        }
+        m_Started.store(false, std::memory_order_release);
+    }
+
+    // Picks the CPUs worker i may run on according to the affinity option.
+    void place(Worker& worker, unsigned int index, const std::vector<std::vector<int>>& nodes) {
+        size_t node = 0;
+        switch (m_Options.affinity) {
+            case Affinity::NONE: {
+                if (m_Options.numaNode >= 0) {
+                    worker.cpus = nodes[0];
+                }
+                return;
+            }
+            case Affinity::COMPACT: {
+                size_t slot = index % std::max<size_t>(1, CountCpus(nodes));
+                while (slot >= nodes[node].size()) {
+                    slot -= nodes[node].size();
+                    node++;
+                }
+                worker.cpus.assign(1, nodes[node][slot]);
+                break;
+            }
+            case Affinity::SCATTER: {
+                node = index % nodes.size();
+                worker.cpus.assign(1, nodes[node][(index / nodes.size()) % nodes[node].size()]);
+                break;
+            }
+        }
+        worker.node = (int)node;
+    }
+
+    void pin(Worker& worker) {
+#if defined(__linux__)
+        if (worker.cpus.empty()) {
+            return;
+        }
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : worker.cpus) {
+            CPU_SET(cpu, &set);
+        }
+        pthread_setaffinity_np(worker.thread.native_handle(), sizeof(set), &set);
+#endif
+    }
+
+    void loop(Worker& self) {
+        t_Scheduler = this;
+        t_Worker = &self;
+
+        for (;;) {
+            Job* job = self.deque.take();
+            if (!job) {
+                job = steal(self);
+            }
+            if (!job) {
+                job = popInjected();
+            }
+
+            if (job) {
+                execute(self, job);
+            } else if (!idle()) {
+                return;
+            }
+        }
+    }
+
+    Job* steal(Worker& self) {
+        for (Worker* victim : self.victims) {
+            if (victim->deque.empty()) {
+                continue;
+            }
+            self.stealAttempts.fetch_add(1, std::memory_order_relaxed);
+            if (Job* job = victim->deque.steal()) {
+                self.stolen.fetch_add(1, std::memory_order_relaxed);
+                return job;
+            }
+        }
+        return nullptr;
+    }
+
+    void inject(Job& job) {
+        start();
+        {
+            std::lock_guard<std::mutex> lock(m_InjectMutex);
+            m_Injection.push_back(&job);
+            m_InjectedPending.fetch_add(1, std::memory_order_relaxed);
+        }
+        m_Injected.fetch_add(1, std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_Sleeping.load(std::memory_order_relaxed) > 0) {
+            wake();
+        }
+    }
+
+    Job* popInjected() {
+        if (m_InjectedPending.load(std::memory_order_relaxed) == 0) {
+            return nullptr;
+        }
+
+        std::lock_guard<std::mutex> lock(m_InjectMutex);
+        if (m_Injection.empty()) {
+            return nullptr;
+        }
+        Job* job = m_Injection.front();
+        m_Injection.pop_front();
+        m_InjectedPending.fetch_sub(1, std::memory_order_relaxed);
+        return job;
+    }
+
+    void execute(Worker& self, Job* job) {
+        self.executed.fetch_add(1, std::memory_order_relaxed);
+        if (job->detached) {
+            job->execute(job);
+            return;
+        }
+
+        // The waiter in run() may return, destroying the job and the
+        // semaphore, as soon as it is released; nothing is touched after.
+        if (std::binary_semaphore* done = job->done) {
+            job->execute(job);
+            done->release();
+            return;
+        }
+
+        job->execute(job);
+        job->finished.store(true, std::memory_order_release);
+    }
+
+    // Spins briefly, then sleeps until new work is pushed. Returns false
+    // once the scheduler is stopping and no work is left.
+    bool idle() {
+        for (int spin = 0; spin < 64; spin++) {
+            if (hasWork()) {
+                return true;
+            }
+            std::this_thread::yield();
+        }
+
+        std::unique_lock<std::mutex> lock(m_IdleMutex);
+        m_Sleeping.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool running = true;
+        if (!hasWork()) {
+            if (m_Stopping) {
+                running = false;
+            } else {
+                m_Idle.wait(lock);
+            }
+        }
+        m_Sleeping.fetch_sub(1, std::memory_order_relaxed);
+        return running;
+    }
+
+    bool hasWork() const {
+        if (m_InjectedPending.load(std::memory_order_relaxed) > 0) {
+            return true;
+        }
+        for (const std::unique_ptr<Worker>& worker : m_Workers) {
+            if (!worker->deque.empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void wake() {
+        std::lock_guard<std::mutex> lock(m_IdleMutex);
+        m_Idle.notify_one();
+    }
+
+    static Options OptionsFromEnvironment() {
+        Options options;
+        if (const char* threads = std::getenv("TASK_THREADS")) {
+            options.threads = (unsigned int)std::max(0, std::atoi(threads));
+        }
+        if (const char* affinity = std::getenv("TASK_AFFINITY")) {
+            std::string_view name = affinity;
+            options.affinity = name == "compact" ? Affinity::COMPACT : name == "scatter" ? Affinity::SCATTER : Affinity::NONE;
+        }
+        if (const char* node = std::getenv("TASK_NUMA_NODE")) {
+            options.numaNode = std::atoi(node);
+        }
+        return options;
+    }
+
+    static size_t CountCpus(const std::vector<std::vector<int>>& nodes) {
+        size_t count = 0;
+        for (const std::vector<int>& node : nodes) {
+            count += node.size();
+        }
+        return count;
+    }
+
+    // CPUs this process may use, grouped by NUMA node. Falls back to a
+    // single node holding every CPU when sysfs has no node information.
+    static std::vector<std::vector<int>> NumaNodes() {
+        std::vector<std::vector<int>> nodes;
+#if defined(__linux__)
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        bool restricted = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+        for (int node = 0;; node++) {
+            std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            std::string list;
+            if (!file || !std::getline(file, list)) {
+                break;
+            }
+
+            std::vector<int> cpus;
+            std::istringstream ranges(list);
+            std::string range;
+            while (std::getline(ranges, range, ',')) {
+                int first = 0;
+                int last = 0;
+                size_t dash = range.find('-');
+                first = std::atoi(range.c_str());
+                last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+                for (int cpu = first; cpu <= last; cpu++) {
+                    if (!restricted || CPU_ISSET(cpu, &allowed)) {
+                        cpus.push_back(cpu);
+                    }
+                }
+            }
+            if (!cpus.empty()) {
+                nodes.push_back(std::move(cpus));
+            }
+        }
+#endif
+        if (nodes.empty()) {
+            nodes.emplace_back();
+            for (unsigned int cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++) {
+                nodes.back().push_back((int)cpu);
+            }
+        }
+        return nodes;
+    }
+
+    static inline thread_local TaskScheduler* t_Scheduler = nullptr;
+    static inline thread_local Worker* t_Worker = nullptr;
+
+    Options m_Options;
+    bool m_Configured;
+    std::atomic<bool> m_Started;
+    std::mutex m_StartMutex;
+    std::vector<std::unique_ptr<Worker>> m_Workers;
+
+    std::mutex m_InjectMutex;
+    std::deque<Job*> m_Injection;
+    std::atomic<uint64_t> m_InjectedPending { 0 };
+    std::atomic<uint64_t> m_Injected { 0 };
+
+    std::mutex m_IdleMutex;
+    std::condition_variable m_Idle;
+    std::atomic<int> m_Sleeping { 0 };
+    bool m_Stopping;
+};
+
+TaskScheduler g_TaskScheduler;
+
+// Fork-join helpers on g_TaskScheduler. Ranges are split in halves down to
+// the grain size; the left half runs on the calling worker while the right
+// half waits on its deque for a thief. Calls from outside the pool hand the
+// whole operation to a worker and wait. Ranges no larger than the grain run
+// inline without touching the pool.
+namespace Parallel {
+
+    template <typename Fn>
+    struct FunctionJob : TaskScheduler::Job {
+        const Fn& fn;
+
+        explicit FunctionJob(const Fn& function) : fn(function) {
+            execute = [](TaskScheduler::Job* job) {
+                static_cast<FunctionJob*>(job)->fn();
+            };
+        }
+    };
+
+    // Runs fn on a worker of the pool and waits for it.
+    template <typename Fn>
+    void Run(const Fn& fn) {
+        if (g_TaskScheduler.onWorker()) {
+            fn();
+            return;
+        }
+        FunctionJob<Fn> job(fn);
+        g_TaskScheduler.run(job);
+    }
+
+    // Runs left and right in parallel and returns when both are done.
+    template <typename Left, typename Right>
+    void Invoke(const Left& left, const Right& right) {
+        if (!g_TaskScheduler.onWorker()) {
+            Run([&]() {
+                Invoke(left, right);
+            });
+            return;
+        }
+
+        FunctionJob<Right> job(right);
+        g_TaskScheduler.spawn(job);
+        left();
+        g_TaskScheduler.join(job);
+    }
+
+    template <typename Fn>
+    void ForRange(size_t begin, size_t end, size_t grain, const Fn& fn) {
+        if (end - begin <= grain) {
+            fn(begin, end);
+            return;
+        }
+
+        size_t middle = begin + (end - begin) / 2;
+        Invoke([&]() {
+            ForRange(begin, middle, grain, fn);
+        }, [&]() {
+            ForRange(middle, end, grain, fn);
+        });
+    }
+
+    // Calls fn(chunkBegin, chunkEnd) over [begin, end) in chunks of at most
+    // grain items.
+    template <typename Fn>
+    void For(size_t begin, size_t end, size_t grain, const Fn& fn) {
+        grain = std::max<size_t>(1, grain);
+        if (end <= begin) {
+            return;
+        }
+        if (end - begin <= grain) {
+            fn(begin, end);
+            return;
+        }
+
+        Run([&]() {
+            ForRange(begin, end, grain, fn);
+        });
+    }
+
+    template <typename T, typename Map, typename Combine>
+    T ReduceRange(size_t begin, size_t end, size_t grain, const Map& map, const Combine& combine) {
+        if (end - begin <= grain) {
+            return map(begin, end);
+        }
+
+        size_t middle = begin + (end - begin) / 2;
+        T left;
+        T right;
+        Invoke([&]() {
+            left = ReduceRange<T>(begin, middle, grain, map, combine);
+        }, [&]() {
+            right = ReduceRange<T>(middle, end, grain, map, combine);
+        });
+        return combine(std::move(left), std::move(right));
+    }
+
+    // Combines map(chunkBegin, chunkEnd) over [begin, end) with combine.
+    // Chunks are combined in order, so combine only needs to be associative.
+    template <typename T, typename Map, typename Combine>
+    T Reduce(size_t begin, size_t end, size_t grain, T identity, const Map& map, const Combine& combine) {
+        grain = std::max<size_t>(1, grain);
+        if (end <= begin) {
+            return identity;
+        }
+        if (end - begin <= grain) {
+            return map(begin, end);
+        }
+
+        T result = identity;
+        Run([&]() {
+            result = ReduceRange<T>(begin, end, grain, map, combine);
+        });
+        return result;
+    }
+
+    // Sorts chunks of grain elements in parallel, then merges them pairwise
+    // through a scratch buffer. The result only depends on the grain, not on
+    // the thread count. Needs contiguous iterators.
+    template <typename Iterator, typename Compare>
+    void Sort(Iterator first, Iterator last, Compare compare, size_t grain = 1 << 15) {
+        typedef typename std::iterator_traits<Iterator>::value_type Value;
+
+        size_t count = (size_t)(last - first);
+        if (count <= grain) {
+            std::sort(first, last, compare);
+            return;
+        }
+
+        Value* data = &*first;
+        size_t chunks = (count + grain - 1) / grain;
+        For(0, chunks, 1, [&](size_t begin, size_t end) {
+            for (size_t chunk = begin; chunk < end; chunk++) {
+                std::sort(data + chunk * grain, data + std::min(count, (chunk + 1) * grain), compare);
+            }
+        });
+
+        std::vector<Value> buffer(count);
+        Value* source = data;
+        Value* target = buffer.data();
+        for (size_t width = grain; width < count; width *= 2) {
+            size_t pairs = (count + 2 * width - 1) / (2 * width);
+            For(0, pairs, 1, [&](size_t begin, size_t end) {
+                for (size_t pair = begin; pair < end; pair++) {
+                    size_t left = pair * 2 * width;
+                    size_t middle = std::min(count, left + width);
+                    size_t right = std::min(count, left + 2 * width);
+                    std::merge(source + left, source + middle, source + middle, source + right, target + left, compare);
+                }
+            });
+            std::swap(source, target);
+        }
+
+        if (source != data) {
+            For(0, count, grain, [&](size_t begin, size_t end) {
+                std::copy(source + begin, source + end, data + begin);
+            });
+        }
+    }
+}
 
 enum class ColumnFormat {
     AUTO,
@@ -26,48 +851,64 @@ class Tabulator {
 
     Tabulator(std::vector < std::string > headers,
         unsigned int static_column_size = 0,
-        unsigned int cell_padding = 1): _headers(headers),
+        unsigned int cell_padding = 1): _headers(std::move(headers)),
     _num_columns(std::tuple_size < RowData > ::value),
     _static_column_size(static_column_size),
     _cell_padding(cell_padding) {
-        assert(headers.size() == _num_columns);
+        assert(_headers.size() == _num_columns);
     }
 
     void addRow(Ts...entries) {
         _data.emplace_back(std::make_tuple(entries...));
     }
 
+    // Builds the row in place. With std::string_view columns nothing is
+    // copied, but the viewed strings must outlive print().
+    template < class...Args >
+    void emplaceRow(Args && ...entries) {
+        _data.emplace_back(std::forward < Args > (entries)...);
+    }
+
+    void reserve(size_t rows) {
+        _data.reserve(rows);
+    }
+
     template < typename StreamType >
     void print(StreamType & stream) {
         computeColumnSizes();
+        printTable(stream, 0, _data.size(), [this](size_t i) -> const RowData & {
+            return _data[i];
+        });
+    }
 
-        unsigned int total_width = _num_columns + 1;
-
-        for (auto & col_size: _column_sizes)
-            total_width += col_size + (2 * _cell_padding);
-
-        stream << std::string(total_width, '-') << "\n";
-
-        stream << "|";
-        for (unsigned int i = 0; i < _num_columns; i++) {
-            auto half = _column_sizes[i] / 2;
-            half -= _headers[i].size() / 2;
-
-            stream << std::string(_cell_padding, ' ') << std::setw(_column_sizes[i]) << std::left <<
-                std::string(half, ' ') + _headers[i] << std::string(_cell_padding, ' ') << "|";
-        }
-
-        stream << "\n";
-
-        stream << std::string(total_width, '-') << "\n";
-
-        for (auto & row: _data) {
-            stream << "|";
-            printRow(row, stream);
-            stream << "\n";
+    // Prints rows [first, first + count) of a rowCount-row table without
+    // storing any of them: row(i) returns row i, usually as views into the
+    // caller's own storage, and may be called from several threads. Column
+    // widths are the wider of an evenly spaced sample of at most widthSample
+    // rows and the printed rows, so the cost is O(count + widthSample)
+    // however large the table is. Widths mostly stay put while scrolling,
+    // but a window holding a cell wider than every sampled one widens that
+    // column for as long as it is on screen; nothing is truncated.
+    template < typename StreamType, typename RowSource >
+    void printWindow(StreamType & stream, const RowSource & row, size_t rowCount,
+        size_t first = 0, size_t count = SIZE_MAX, size_t widthSample = 256) {
+        first = std::min(first, rowCount);
+        size_t last = first + std::min(count, rowCount - first);
+
+        resetColumnSizes();
+        widenColumns(measureRows(first, last, row));
+
+        if (last - first < rowCount && widthSample > 0) {
+            size_t stride = std::max < size_t > (1, rowCount / widthSample);
+            std::vector < size_t > column_sizes(_num_columns);
+
+            for (size_t i = 0; i < rowCount; i += stride) {
+                determineSizes(row(i), column_sizes);
+                widenColumns(column_sizes);
+            }
         }
 
-        stream << std::string(total_width, '-') << "\n";
+        printTable(stream, first, last, row);
     }
 
     void setColumnFormat(const std::vector < ColumnFormat > & column_format) {
@@ -80,7 +921,11 @@ class Tabulator {
         _precision = precision;
     }
 
-    protected: typedef decltype( & std::right) right_type;
+    protected:
+    // Tables with more rows than this are measured and formatted in parallel.
+    static constexpr size_t PARALLEL_ROWS = 4096;
+
+    typedef decltype( & std::right) right_type;
     typedef decltype( & std::left) left_type;
 
     template < typename T,
@@ -193,19 +1038,101 @@ class Tabulator {
     }
 
     void computeColumnSizes() {
-        _column_sizes.resize(_num_columns);
+        resetColumnSizes();
+        widenColumns(measureRows(0, _data.size(), [this](size_t i) -> const RowData & {
+            return _data[i];
+        }));
+    }
 
-        std::vector < size_t > column_sizes(_num_columns);
+    void resetColumnSizes() {
+        _column_sizes.resize(_num_columns);
 
         for (unsigned int i = 0; i < _num_columns; i++)
             _column_sizes[i] = _headers[i].size();
+    }
 
-        for (auto & row: _data) {
-            determineSizes(row, column_sizes);
-
-            for (unsigned int i = 0; i < _num_columns; i++)
-                _column_sizes[i] = std::max(_column_sizes[i], column_sizes[i]);
+    void widenColumns(const std::vector < size_t > & widths) {
+        for (unsigned int i = 0; i < _num_columns; i++)
+            _column_sizes[i] = std::max(_column_sizes[i], widths[i]);
+    }
+
+    template < typename RowSource >
+    std::vector < size_t > measureRows(size_t first, size_t last, const RowSource & row) {
+        return Parallel::Reduce(first, last, PARALLEL_ROWS, std::vector < size_t > (_num_columns),
+            [this, &row](size_t begin, size_t end) {
+                std::vector < size_t > widths(_num_columns);
+                std::vector < size_t > column_sizes(_num_columns);
+
+                for (size_t i = begin; i < end; i++) {
+                    determineSizes(row(i), column_sizes);
+
+                    for (unsigned int j = 0; j < _num_columns; j++)
+                        widths[j] = std::max(widths[j], column_sizes[j]);
+                }
+                return widths;
+            },
+            [](std::vector < size_t > left,
+                const std::vector < size_t > & right) {
+                for (size_t i = 0; i < left.size(); i++)
+                    left[i] = std::max(left[i], right[i]);
+                return left;
+            });
+    }
+
+    // Prints the header and rows [first, last) with the current column sizes.
+    template < typename StreamType, typename RowSource >
+    void printTable(StreamType & stream, size_t first, size_t last, const RowSource & row) {
+        unsigned int total_width = _num_columns + 1;
+
+        for (auto & col_size: _column_sizes)
+            total_width += col_size + (2 * _cell_padding);
+
+        stream << std::string(total_width, '-') << "\n";
+
+        stream << "|";
+        for (unsigned int i = 0; i < _num_columns; i++) {
+            auto half = _column_sizes[i] / 2;
+            half -= _headers[i].size() / 2;
+
+            stream << std::string(_cell_padding, ' ') << std::setw(_column_sizes[i]) << std::left <<
+                std::string(half, ' ') + _headers[i] << std::string(_cell_padding, ' ') << "|";
+        }
+
+        stream << "\n";
+
+        stream << std::string(total_width, '-') << "\n";
+
+        if (last - first <= PARALLEL_ROWS) {
+            for (size_t i = first; i < last; i++) {
+                stream << "|";
+                printRow(row(i), stream);
+                stream << "\n";
+            }
+        } else {
+            // Large tables are formatted in chunks on g_TaskScheduler, each
+            // chunk into its own string with the stream's formatting state.
+            size_t chunks = (last - first + PARALLEL_ROWS - 1) / PARALLEL_ROWS;
+            std::vector < std::string > text(chunks);
+            Parallel::For(0, chunks, 1, [&](size_t begin, size_t end) {
+                for (size_t chunk = begin; chunk < end; chunk++) {
+                    std::ostringstream out;
+                    out.copyfmt(stream);
+                    out.tie(nullptr);
+                    size_t chunk_last = std::min(last, first + (chunk + 1) * PARALLEL_ROWS);
+                    for (size_t i = first + chunk * PARALLEL_ROWS; i < chunk_last; i++) {
+                        out << "|";
+                        printRow(row(i), out);
+                        out << "\n";
+                    }
+                    text[chunk] = std::move(out).str();
+                }
+            });
+
+            for (auto & chunk: text)
+                stream << chunk;
         }
+
+        stream << std::string(total_width, '-') << "\n";
     }
 
     std::vector < std::string > _headers;
@@ -218,36 +1145,405 @@ class Tabulator {
     std::vector < int > _precision;
 };
 
+// Scoped tracing. Build with -DENABLE_TRACING=1 to record spans into a
+// per-thread ring buffer and dump them as Chrome trace-event JSON on exit
+// (open the file in Perfetto or chrome://tracing). When tracing is compiled
+// out TRACE_SCOPE expands to nothing.
+#ifndef ENABLE_TRACING
+#define ENABLE_TRACING 0
+#endif
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+
+#if ENABLE_TRACING
+
+namespace Trace {
+
+    struct Event {
+        const char* name;
+        uint64_t startNs;
+        uint64_t durationNs;
+    };
+
+    inline uint64_t Now() {
+        static const std::chrono::steady_clock::time_point s_Epoch = std::chrono::steady_clock::now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_Epoch).count();
+    }
+
+    // Single producer (the owning thread) ring buffer; recording never takes
+    // a lock. When full the oldest spans are overwritten, possibly while
+    // forEach() reads them, so every slot carries a sequence number (its
+    // position + 1, 0 while being written) and is read like a seqlock:
+    // forEach() skips slots that were overwritten or torn under it.
+    class ThreadBuffer {
+        public:
+        static constexpr size_t CAPACITY = 1 << 16;
+
+        explicit ThreadBuffer(uint32_t threadID) : m_Slots(CAPACITY), m_Head(0), m_ThreadID(threadID) {
+        }
+
+        void push(const char* name, uint64_t startNs, uint64_t durationNs) {
+            uint64_t head = m_Head.load(std::memory_order_relaxed);
+            Slot& slot = m_Slots[head & (CAPACITY - 1)];
+            slot.sequence.store(0, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.name.store(name, std::memory_order_relaxed);
+            slot.startNs.store(startNs, std::memory_order_relaxed);
+            slot.durationNs.store(durationNs, std::memory_order_relaxed);
+            slot.sequence.store(head + 1, std::memory_order_release);
+            m_Head.store(head + 1, std::memory_order_release);
+        }
+
+        // Calls fn with each of the last CAPACITY spans, oldest first.
+        template <typename Fn>
+        void forEach(Fn&& fn) const {
+            uint64_t head = m_Head.load(std::memory_order_acquire);
+            uint64_t first = head > CAPACITY ? head - CAPACITY : 0;
+            for (uint64_t i = first; i < head; i++) {
+                const Slot& slot = m_Slots[i & (CAPACITY - 1)];
+                if (slot.sequence.load(std::memory_order_acquire) != i + 1) {
+                    continue;
+                }
+                Event event = {slot.name.load(std::memory_order_relaxed), slot.startNs.load(std::memory_order_relaxed),
+                    slot.durationNs.load(std::memory_order_relaxed)};
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.sequence.load(std::memory_order_relaxed) != i + 1) {
+                    continue;
+                }
+                fn(event);
+            }
+        }
+
+        uint32_t getThreadID() const {
+            return m_ThreadID;
+        }
+
+        private:
+        struct Slot {
+            std::atomic<uint64_t> sequence { 0 };
+            std::atomic<const char*> name { nullptr };
+            std::atomic<uint64_t> startNs { 0 };
+            std::atomic<uint64_t> durationNs { 0 };
+        };
+
+        std::vector<Slot> m_Slots;
+        std::atomic<uint64_t> m_Head;
+        uint32_t m_ThreadID;
+    };
+
+    // Buffers outlive their threads so spans from finished workers still
+    // make it into the dump. The lock is only taken once per thread.
+    inline std::mutex g_RegistryMutex;
+    inline std::vector<std::shared_ptr<ThreadBuffer>> g_Buffers;
+
+    inline ThreadBuffer& LocalBuffer() {
+        thread_local ThreadBuffer* t_Buffer = nullptr;
+        if (!t_Buffer) {
+            std::lock_guard<std::mutex> lock(g_RegistryMutex);
+            g_Buffers.push_back(std::make_shared<ThreadBuffer>((uint32_t)g_Buffers.size() + 1));
+            t_Buffer = g_Buffers.back().get();
+        }
+        return *t_Buffer;
+    }
+
+    class Scope {
+        public:
+        explicit Scope(const char* name) : m_Name(name), m_Start(Now()) {
+        }
+
+        ~Scope() {
+            uint64_t end = Now();
+            LocalBuffer().push(m_Name, m_Start, end - m_Start);
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        private:
+        const char* m_Name;
+        uint64_t m_Start;
+    };
+
+    inline void WriteJsonString(std::ostream& stream, const char* str) {
+        stream << '"';
+        for (; *str; str++) {
+            if (*str == '"' || *str == '\\') {
+                stream << '\\';
+            }
+            stream << *str;
+        }
+        stream << '"';
+    }
+
+    // Writes every recorded span in the Chrome trace-event format ("X"
+    // complete events, timestamps in microseconds).
+    inline void WriteChromeJson(std::ostream& stream) {
+        std::lock_guard<std::mutex> lock(g_RegistryMutex);
+
+        stream << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        bool first = true;
+        for (auto& buffer : g_Buffers) {
+            buffer->forEach([&](const Event& event) {
+                stream << (first ? "\n" : ",\n") << "{\"name\":";
+                WriteJsonString(stream, event.name);
+                stream << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->getThreadID()
+                       << ",\"ts\":" << event.startNs / 1000 << '.' << std::setw(3) << std::setfill('0') << event.startNs % 1000
+                       << ",\"dur\":" << event.durationNs / 1000 << '.' << std::setw(3) << event.durationNs % 1000
+                       << std::setfill(' ') << "}";
+                first = false;
+            });
+        }
+        stream << "\n]}\n";
+    }
+
+    inline bool WriteChromeJson(const char* path) {
+        std::ofstream file(path, std::ios::binary);
+        if (!file) {
+            return false;
+        }
+        WriteChromeJson(file);
+        return (bool)file;
+    }
+}
+
+#define TRACE_SCOPE(name) Trace::Scope TRACE_CONCAT(traceScope_, __LINE__)(name)
+
+#else
+
+#define TRACE_SCOPE(name) ((void)0)
+
+#endif
+
+// Allocation counting. Build with -DCOUNT_ALLOCATIONS=1 to route the global
+// operator new through a counter that benchmarks read with
+// AllocationCounter::Count(). Off by default so normal builds keep the
+// library allocator untouched.
+#ifndef COUNT_ALLOCATIONS
+#define COUNT_ALLOCATIONS 0
+#endif
+
+namespace AllocationCounter {
+
+    inline std::atomic<uint64_t> g_Allocations { 0 };
+    inline std::atomic<uint64_t> g_Bytes { 0 };
+
+    inline constexpr bool Enabled() {
+        return COUNT_ALLOCATIONS != 0;
+    }
+
+    inline uint64_t Count() {
+        return g_Allocations.load(std::memory_order_relaxed);
+    }
+
+    inline uint64_t Bytes() {
+        return g_Bytes.load(std::memory_order_relaxed);
+    }
+}
+
+#if COUNT_ALLOCATIONS
+
+// GCC inlines the replaced delete into std::allocator and then flags the
+// free() as not matching the builtin new.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size) {
+    AllocationCounter::g_Allocations.fetch_add(1, std::memory_order_relaxed);
+    AllocationCounter::g_Bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* pointer = std::malloc(size ? size : 1)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+// Replaced as well so memory from the library's nothrow new (e.g.
+// std::stable_sort's scratch buffer) is never freed by the delete below.
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    AllocationCounter::g_Allocations.fetch_add(1, std::memory_order_relaxed);
+    AllocationCounter::g_Bytes.fetch_add(size, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept {
+    std::free(pointer);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif
+
 namespace Random
 {
-	static std::random_device g_RandomDevice;
-	static bool				  g_IsDeviceInitialized = false;
-	static std::mt19937		  g_Generator;
+	// xoshiro256** (Blackman & Vigna). Small state, no locking, and several
+	// times faster than std::mt19937 + std::uniform_int_distribution.
+	class Xoshiro256
+	{
+	public:
+		explicit Xoshiro256(uint64_t seed = 0, uint64_t stream = 0) { reseed(seed, stream); }
+
+		void reseed(uint64_t seed, uint64_t stream)
+		{
+			uint64_t mix = seed ^ SplitMix(stream + 0x632BE59BD9B4E019ull);
+			for (uint64_t& word : m_State)
+				word = SplitMix(mix);
+		}
+
+		uint64_t next()
+		{
+			const uint64_t result = Rotl(m_State[1] * 5, 7) * 9;
+			const uint64_t t = m_State[1] << 17;
+
+			m_State[2] ^= m_State[0];
+			m_State[3] ^= m_State[1];
+			m_State[1] ^= m_State[2];
+			m_State[0] ^= m_State[3];
+			m_State[2] ^= t;
+			m_State[3] = Rotl(m_State[3], 45);
+
+			return result;
+		}
+
+	private:
+		static uint64_t Rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+		static uint64_t SplitMix(uint64_t& x)
+		{
+			uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+			return z ^ (z >> 31);
+		}
+
+		static uint64_t SplitMix(uint64_t&& x) { return SplitMix(x); }
+
+		uint64_t m_State[4];
+	};
+
+	// Every thread owns its generator. A stream id picks an independent
+	// sequence for a given seed; threads take the next free id on their first
+	// draw unless one was set with SetThreadStream, which is what load tests
+	// should do to be reproducible. SetSeed bumps an epoch so every thread
+	// reseeds lazily on its next draw.
+	static std::atomic<uint64_t> g_Seed { 0 };
+	static std::atomic<uint32_t> g_SeedEpoch { 0 };
+	static std::atomic<uint64_t> g_NextStream { 0 };
+
+	struct ThreadState
+	{
+		Xoshiro256 generator;
+		uint32_t   epoch = UINT32_MAX;
+		uint64_t   stream = 0;
+		bool	   fixedStream = false;
+	};
+
+	inline ThreadState& LocalState()
+	{
+		thread_local ThreadState t_State;
+		return t_State;
+	}
+
+	inline uint64_t DefaultSeed()
+	{
+		static const uint64_t s_Seed = [] {
+			std::random_device device;
+			return ((uint64_t)device() << 32 | device()) ^
+				(uint64_t)std::chrono::high_resolution_clock::now().time_since_epoch().count();
+		}();
+		return s_Seed;
+	}
+
+	inline void SetSeed(uint64_t seed)
+	{
+		g_Seed.store(seed, std::memory_order_relaxed);
+		g_NextStream.store(0, std::memory_order_relaxed);
+		g_SeedEpoch.fetch_add(1, std::memory_order_release);
+	}
+
+	inline void SetThreadStream(uint64_t stream)
+	{
+		ThreadState& state = LocalState();
+		state.stream = stream;
+		state.fixedStream = true;
+		state.epoch = UINT32_MAX;
+	}
+
+	inline Xoshiro256& Generator()
+	{
+		ThreadState& state = LocalState();
+		uint32_t epoch = g_SeedEpoch.load(std::memory_order_acquire);
+		if (state.epoch != epoch)
+		{
+			if (!state.fixedStream)
+			{
+				state.stream = g_NextStream.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			uint64_t seed = epoch == 0 ? DefaultSeed() : g_Seed.load(std::memory_order_relaxed);
+			state.generator.reseed(seed, state.stream);
+			state.epoch = epoch;
+		}
+		return state.generator;
+	}
 
-	inline int32_t Gen(int32_t min, int32_t max)
+	// Unbiased value in [0, range) using Lemire's multiply-and-reject.
+	inline uint32_t Bounded(Xoshiro256& generator, uint32_t range)
 	{
-		if (!g_IsDeviceInitialized)
+		uint64_t m = (generator.next() >> 32) * range;
+		uint32_t low = (uint32_t)m;
+		if (low < range)
 		{
-			std::mt19937::result_type seed =
-				g_RandomDevice() ^ ((std::mt19937::result_type)std::chrono::duration_cast<std::chrono::seconds>(
-							std::chrono::system_clock::now().time_since_epoch())
-							.count() +
-						(std::mt19937::result_type)std::chrono::duration_cast<std::chrono::microseconds>(
-							std::chrono::high_resolution_clock::now().time_since_epoch())
-							.count());
-
-			g_Generator.seed(seed);
-			g_IsDeviceInitialized = true;
+			uint32_t threshold = (0u - range) % range;
+			while (low < threshold)
+			{
+				m = (generator.next() >> 32) * range;
+				low = (uint32_t)m;
+			}
 		}
+		return (uint32_t)(m >> 32);
+	}
+
+	inline int32_t Gen(Xoshiro256& generator, int32_t min, int32_t max)
+	{
+		uint32_t range = (uint32_t)max - (uint32_t)min + 1;
+		if (range == 0)
+			return (int32_t)(generator.next() >> 32);
+
+		return (int32_t)((uint32_t)min + Bounded(generator, range));
+	}
+
+	inline int32_t Gen(int32_t min, int32_t max) { return Gen(Generator(), min, max); }
+
+	// Uniform double in [0, 1) from the top 53 bits.
+	inline double GenDouble() { return (double)(Generator().next() >> 11) * 0x1.0p-53; }
+
+	// chanceOfTrue is a percentage in [0, 100].
+	inline bool Gen(double chanceOfTrue) { return GenDouble() * 100.0 < chanceOfTrue; }
 
-		std::uniform_int_distribution<int32_t> distrib(min, max);
-		return distrib(g_Generator);
+	inline void Fill(int32_t* out, size_t count, int32_t min, int32_t max)
+	{
+		Xoshiro256& generator = Generator();
+		for (size_t i = 0; i < count; i++)
+			out[i] = Gen(generator, min, max);
 	}
 
-	inline bool Gen(double chanceOfTrue) 
+	inline void Fill(double* out, size_t count)
 	{
-		int random = Gen(0, 100);
-		return random < chanceOfTrue;
+		Xoshiro256& generator = Generator();
+		for (size_t i = 0; i < count; i++)
+			out[i] = (double)(generator.next() >> 11) * 0x1.0p-53;
 	}
 } 
 
@@ -266,11 +1562,11 @@ namespace Text {
 		str.erase(remove(str.begin(), str.end(), ' '), str.end());
 	}
 
-    inline bool HasText(const std::string& mainString, const std::string& substring, bool caseSensitive = true) {
+    inline bool HasText(std::string_view mainString, std::string_view substring, bool caseSensitive = true) {
         
         if (!caseSensitive) {
-            std::string mainStringCopy = mainString;
-            std::string substringCopy = substring;
+            std::string mainStringCopy(mainString);
+            std::string substringCopy(substring);
             Text::RemoveSpaces(mainStringCopy);
             Text::RemoveSpaces(substringCopy);
             std::transform(mainStringCopy.begin(), mainStringCopy.end(), mainStringCopy.begin(), ::tolower);
@@ -297,12 +1593,12 @@ namespace Text {
 		return false;
 	}
 
-	inline bool StartsWithString(const std::string& str, const std::string& prefix) {
+	inline bool StartsWithString(std::string_view str, std::string_view prefix) {
 		if (str.length() < prefix.length()) {
 			return false; 
 		}
 
-		return str.substr(0, prefix.length()) == prefix;
+		return str.compare(0, prefix.length(), prefix) == 0;
 	}
 }
 
@@ -317,6 +1613,332 @@ enum class SortType {
     ID,
 };
 
+// Bit-parallel Levenshtein distance (Myers, in Hyyro's formulation) between
+// one query and many candidates. Each candidate character costs a handful
+// of word operations regardless of the query length. Queries longer than 64
+// characters are truncated to 64.
+class FuzzyMatcher {
+
+    public:
+    explicit FuzzyMatcher(std::string_view pattern) {
+        m_Length = std::min<size_t>(pattern.size(), 64);
+        std::fill(m_Peq, m_Peq + 256, 0);
+        for (size_t i = 0; i < m_Length; i++) {
+            m_Peq[(uint8_t)std::tolower((uint8_t)pattern[i])] |= 1ull << i;
+        }
+        m_Mask = m_Length == 64 ? ~0ull : (1ull << m_Length) - 1;
+        m_LastBit = m_Length ? 1ull << (m_Length - 1) : 0;
+    }
+
+    size_t length() const {
+        return m_Length;
+    }
+
+    // Distance to an already lowercased candidate, or maxDistance + 1 as soon
+    // as the distance is known to exceed maxDistance.
+    int distance(const char* text, size_t length, int maxDistance) const {
+        if (m_Length == 0) {
+            return (int)length;
+        }
+
+        uint64_t pv = m_Mask;
+        uint64_t mv = 0;
+        int score = (int)m_Length;
+
+        for (size_t j = 0; j < length; j++) {
+            uint64_t eq = m_Peq[(uint8_t)text[j]];
+            uint64_t xv = eq | mv;
+            uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+            uint64_t ph = mv | ~(xh | pv);
+            uint64_t mh = pv & xh;
+
+            if (ph & m_LastBit) {
+                score++;
+            } else if (mh & m_LastBit) {
+                score--;
+            }
+
+            ph = (ph << 1) | 1;
+            mh <<= 1;
+            pv = mh | ~(xv | ph);
+            mv = ph & xv;
+
+            // The score can drop by at most one per remaining character.
+            if (score - (int)(length - j - 1) > maxDistance) {
+                return maxDistance + 1;
+            }
+        }
+
+        return score;
+    }
+
+    private:
+    uint64_t m_Peq[256];
+    uint64_t m_Mask;
+    uint64_t m_LastBit;
+    size_t m_Length;
+};
+
+// Typo-tolerant name index. Every product contributes its full name and each
+// of its words as lowercased terms, stored in one flat buffer and bucketed by
+// length so a query only scans terms within maxDistance of its own length.
+class FuzzyIndex {
+
+    public:
+    struct Match {
+        int productID;
+        int distance;
+    };
+
+    void clear() {
+        m_Text.clear();
+        m_Terms.clear();
+        m_LengthStart.clear();
+    }
+
+    void add(int productID, std::string_view name) {
+        addTerm(productID, name);
+
+        if (name.find(' ') == std::string_view::npos) {
+            return;
+        }
+
+        size_t start = 0;
+        for (;;) {
+            size_t end = name.find(' ', start);
+            addTerm(productID, name.substr(start, end - start));
+            if (end == std::string_view::npos) {
+                break;
+            }
+            start = end + 1;
+        }
+    }
+
+    // Must be called after the last add and before searching.
+    void finalize() {
+        std::stable_sort(m_Terms.begin(), m_Terms.end(), [](const Term& a, const Term& b) {
+            return a.length < b.length;
+        });
+
+        size_t maxLength = m_Terms.empty() ? 0 : m_Terms.back().length;
+        m_LengthStart.assign(maxLength + 2, 0);
+        for (const Term& term : m_Terms) {
+            m_LengthStart[term.length + 1]++;
+        }
+        for (size_t i = 1; i < m_LengthStart.size(); i++) {
+            m_LengthStart[i] += m_LengthStart[i - 1];
+        }
+    }
+
+    size_t size() const {
+        return m_Terms.size();
+    }
+
+    // Best distance per product, ordered by distance and then product ID.
+    std::vector<Match> search(std::string_view query, int maxDistance, size_t limit) const {
+        std::vector<Match> matches;
+        if (m_LengthStart.empty()) {
+            return matches;
+        }
+
+        FuzzyMatcher matcher(query);
+        size_t queryLength = matcher.length();
+        uint32_t queryMask = characterMask(query.substr(0, queryLength));
+        size_t minLength = queryLength > (size_t)maxDistance ? queryLength - maxDistance : 0;
+        size_t maxLength = std::min(queryLength + maxDistance, m_LengthStart.size() - 2);
+
+        for (size_t length = minLength; length <= maxLength; length++) {
+            for (uint32_t i = m_LengthStart[length]; i < m_LengthStart[length + 1]; i++) {
+                const Term& term = m_Terms[i];
+
+                // Each edit can account for at most one character that only
+                // one side contains, which rules most terms out cheaply.
+                if (popcount(queryMask & ~term.mask) > maxDistance || popcount(term.mask & ~queryMask) > maxDistance) {
+                    continue;
+                }
+
+                int distance = matcher.distance(m_Text.data() + term.offset, term.length, maxDistance);
+                if (distance <= maxDistance) {
+                    matches.push_back({term.productID, distance});
+                }
+            }
+        }
+
+        std::sort(matches.begin(), matches.end(), [](const Match& a, const Match& b) {
+            return a.productID != b.productID ? a.productID < b.productID : a.distance < b.distance;
+        });
+        matches.erase(std::unique(matches.begin(), matches.end(), [](const Match& a, const Match& b) {
+            return a.productID == b.productID;
+        }), matches.end());
+
+        auto byDistance = [](const Match& a, const Match& b) {
+            return a.distance != b.distance ? a.distance < b.distance : a.productID < b.productID;
+        };
+        if (matches.size() > limit) {
+            std::partial_sort(matches.begin(), matches.begin() + limit, matches.end(), byDistance);
+            matches.resize(limit);
+        } else {
+            std::sort(matches.begin(), matches.end(), byDistance);
+        }
+
+        return matches;
+    }
+
+    private:
+    struct Term {
+        uint32_t offset;
+        uint32_t length;
+        uint32_t mask;
+        int productID;
+    };
+
+    // One bit per letter, digits and everything else share the remaining bits.
+    static uint32_t characterMask(std::string_view text) {
+        uint32_t mask = 0;
+        for (char c : text) {
+            uint8_t lower = (uint8_t)std::tolower((uint8_t)c);
+            mask |= 1u << (lower >= 'a' && lower <= 'z' ? lower - 'a' : 26 + lower % 6);
+        }
+        return mask;
+    }
+
+    static int popcount(uint32_t value) {
+        return (int)std::bitset<32>(value).count();
+    }
+
+    void addTerm(int productID, std::string_view term) {
+        if (term.empty()) {
+            return;
+        }
+
+        Term entry = {(uint32_t)m_Text.size(), (uint32_t)term.size(), characterMask(term), productID};
+        for (char c : term) {
+            m_Text.push_back((char)std::tolower((uint8_t)c));
+        }
+        m_Terms.push_back(entry);
+    }
+
+    std::string m_Text;
+    std::vector<Term> m_Terms;
+    std::vector<uint32_t> m_LengthStart;
+};
+
+// Bounded cache of search query -> matching product IDs, split into
+// independently locked LRU shards. Every entry remembers the catalog
+// generation it was computed at and reads as a miss once the catalog has
+// changed since, so invalidation costs nothing on the write path.
+class SearchCache {
+
+    public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t stale = 0;
+        uint64_t evictions = 0;
+
+        double hitRate() const {
+            uint64_t lookups = hits + misses + stale;
+            return lookups ? (double)hits / lookups : 0.0;
+        }
+    };
+
+    explicit SearchCache(size_t capacity = 4096, size_t shardCount = 16) : m_Shards(shardCount) {
+        m_ShardCapacity = std::max<size_t>(1, capacity / shardCount);
+    }
+
+    bool lookup(std::string_view key, uint64_t generation, std::vector<int>& ids) {
+        Shard& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto found = shard.index.find(key);
+        if (found == shard.index.end()) {
+            m_Misses.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        if (found->second->generation != generation) {
+            m_Stale.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+        ids = found->second->ids;
+        m_Hits.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void insert(std::string_view key, uint64_t generation, std::vector<int> ids) {
+        Shard& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto found = shard.index.find(key);
+        if (found != shard.index.end()) {
+            found->second->generation = generation;
+            found->second->ids = std::move(ids);
+            shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+            return;
+        }
+
+        if (shard.lru.size() >= m_ShardCapacity) {
+            shard.index.erase(shard.lru.back().key);
+            shard.lru.pop_back();
+            m_Evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        shard.lru.push_front(Entry{std::string(key), generation, std::move(ids)});
+        shard.index.emplace(shard.lru.front().key, shard.lru.begin());
+    }
+
+    void clear() {
+        for (Shard& shard : m_Shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.index.clear();
+            shard.lru.clear();
+        }
+    }
+
+    Stats getStats() const {
+        Stats stats;
+        stats.hits = m_Hits.load(std::memory_order_relaxed);
+        stats.misses = m_Misses.load(std::memory_order_relaxed);
+        stats.stale = m_Stale.load(std::memory_order_relaxed);
+        stats.evictions = m_Evictions.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    void resetStats() {
+        m_Hits = 0;
+        m_Misses = 0;
+        m_Stale = 0;
+        m_Evictions = 0;
+    }
+
+    private:
+    struct Entry {
+        std::string key;
+        uint64_t generation;
+        std::vector<int> ids;
+    };
+
+    // Index keys point into the list entries, which never move.
+    struct Shard {
+        std::mutex mutex;
+        std::list<Entry> lru;
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+    };
+
+    Shard& shardFor(std::string_view key) {
+        return m_Shards[std::hash<std::string_view>()(key) % m_Shards.size()];
+    }
+
+    std::vector<Shard> m_Shards;
+    size_t m_ShardCapacity;
+    std::atomic<uint64_t> m_Hits { 0 };
+    std::atomic<uint64_t> m_Misses { 0 };
+    std::atomic<uint64_t> m_Stale { 0 };
+    std::atomic<uint64_t> m_Evictions { 0 };
+};
+
 class Product {
     public:
     Product() {
@@ -354,20 +1976,34 @@ class Product {
         m_StockAmount = stockAmount;
     }
 
-    const char* getName() {
-        return m_Name.c_str();
+    // Views stay valid until the next setName/setDescription.
+    std::string_view getName() const {
+        return m_Name;
+    }
+
+    void setName(std::string name) {
+        m_Name = std::move(name);
+        if (m_CatalogGeneration) {
+            m_CatalogGeneration->fetch_add(1, std::memory_order_release);
+        }
+        if (m_NameGeneration) {
+            m_NameGeneration->fetch_add(1, std::memory_order_release);
+        }
     }
 
-    void setName(const char* name) {
-        m_Name = name;
+    // Set by the owning ProductManager so renames invalidate its searches
+    // and its fuzzy index.
+    void setCatalogGeneration(std::atomic<uint64_t>* generation, std::atomic<uint64_t>* nameGeneration = nullptr) {
+        m_CatalogGeneration = generation;
+        m_NameGeneration = nameGeneration;
     }
 
-    const char* getDescription() {
-        return m_Description.c_str();
+    std::string_view getDescription() const {
+        return m_Description;
     }
 
-    void setDescription(const char* description) {
-        m_Description = description;
+    void setDescription(std::string description) {
+        m_Description = std::move(description);
     }
 
     private:
@@ -376,13 +2012,47 @@ class Product {
     int m_StockAmount;
     std::string m_Name;
     std::string m_Description;
+    std::atomic<uint64_t>* m_CatalogGeneration = nullptr;
+    std::atomic<uint64_t>* m_NameGeneration = nullptr;
 };
 
-class ProductManager {
+struct ProductComparator {
+    SortType sortType;
+    SortOrder sortOrder;
+
+    bool operator()(Product* a, Product* b) const {
+        int left = 0;
+        int right = 0;
+        switch(sortType) {
+            case SortType::PRICE: {
+                left = a->getPrice();
+                right = b->getPrice();
+                break;
+            }
+            case SortType::STOCK_AMOUNT: {
+                left = a->getStockAmount();
+                right = b->getStockAmount();
+                break;
+            }
+            case SortType::ID: {
+                left = a->getID();
+                right = b->getID();
+                break;
+            }
+        }
+        return sortOrder == SortOrder::ASCENDING ? left < right : left > right;
+    }
+};
+
+class ProductManager {
     
     public:
-    ProductManager()  {
-        m_LastProductID = 0;   
+    // IDs are handed out as firstID, firstID + idStride, ... so several
+    // managers can share one ID space.
+    ProductManager(int firstID = 1, int idStride = 1)  {
+        m_LastProductID = firstID - idStride;
+        m_IDStride = idStride;
+        m_SearchCacheEnabled = true;
     }
 
     ~ProductManager() {
@@ -392,90 +2062,190 @@ class ProductManager {
     }
 
     Product* getProduct(int ID) {
-        for (Product* product : m_Products) {
-            if (product->getID() == ID) {
-                return product;
-            }
+        TRACE_SCOPE("ProductManager::getProduct");
+        auto found = m_ProductsByID.find(ID);
+        if (found == m_ProductsByID.end()) {
+            return nullptr;
         }
 
-        return nullptr;
+        return found->second;
     }
 
-    Product* getProductByName(const char* name) {
+    Product* getProductByName(std::string_view name) {
+        std::string key = "N";
+        key += name;
+        uint64_t generation = getCatalogGeneration();
+
+        std::vector<int> ids;
+        if (m_SearchCacheEnabled && m_SearchCache.lookup(key, generation, ids)) {
+            return ids.empty() ? nullptr : getProduct(ids.front());
+        }
+
+        Product* match = nullptr;
         for(auto product : m_Products) {
             if(Text::HasText(product->getName(), name)) {
-                return product;
+                match = product;
+                break;
             }
         }
-        return nullptr;
+
+        if (m_SearchCacheEnabled) {
+            if (match) {
+                ids.assign(1, match->getID());
+            }
+            m_SearchCache.insert(key, generation, std::move(ids));
+        }
+        return match;
     }
 
-    std::vector<Product*> getProductsWithString(const char* name) {
+    // Prefix matches first, then the remaining substring matches, each in
+    // catalog order.
+    std::vector<Product*> getProductsWithString(std::string_view name) {
+        std::string key = "S";
+        key += name;
+        uint64_t generation = getCatalogGeneration();
+
+        std::vector<int> ids;
         std::vector<Product*> products;
-        for(auto product : m_Products) {
-            if(Text::StartsWithString(product->getName(), name)) {
-                products.push_back(product);
+        if (m_SearchCacheEnabled && m_SearchCache.lookup(key, generation, ids)) {
+            products.reserve(ids.size());
+            for (int ID : ids) {
+                products.push_back(getProduct(ID));
             }
+            return products;
         }
 
-        for(auto product : m_Products) {
-            if(Text::HasText(product->getName(), name)) {
-                if (std::find(products.begin(), products.end(), product) != products.end()) {
-                    continue;
+        // Large catalogs are scanned in chunks on g_TaskScheduler; the
+        // chunk results are concatenated in catalog order.
+        const size_t grain = 8192;
+        size_t chunks = (m_Products.size() + grain - 1) / grain;
+        std::vector<std::vector<Product*>> prefixMatches(chunks);
+        std::vector<std::vector<Product*>> otherMatches(chunks);
+        Parallel::For(0, chunks, 1, [&](size_t begin, size_t end) {
+            for (size_t chunk = begin; chunk < end; chunk++) {
+                size_t last = std::min(m_Products.size(), (chunk + 1) * grain);
+                for (size_t i = chunk * grain; i < last; i++) {
+                    Product* product = m_Products[i];
+                    if (Text::StartsWithString(product->getName(), name)) {
+                        prefixMatches[chunk].push_back(product);
+                    } else if (Text::HasText(product->getName(), name)) {
+                        otherMatches[chunk].push_back(product);
+                    }
                 }
-                products.push_back(product);
             }
+        });
+
+        for (const std::vector<Product*>& matches : prefixMatches) {
+            products.insert(products.end(), matches.begin(), matches.end());
+        }
+        for (const std::vector<Product*>& matches : otherMatches) {
+            products.insert(products.end(), matches.begin(), matches.end());
         }
 
+        if (m_SearchCacheEnabled) {
+            ids.reserve(products.size());
+            for (Product* product : products) {
+                ids.push_back(product->getID());
+            }
+            m_SearchCache.insert(key, generation, std::move(ids));
+        }
         return products;
     }
 
-    void sortProducts(SortType sortType, SortOrder sortOrder) {
-        switch(sortType) {
-            case SortType::PRICE: {
-                std::sort(m_Products.begin(), m_Products.end(), [sortOrder](Product* a, Product* b) {
-                    if(sortOrder == SortOrder::ASCENDING) {
-                        return a->getPrice() < b->getPrice();
-                    } else {
-                        return a->getPrice() > b->getPrice();
-                    }
-                });
-                break;
-            }
-            case SortType::STOCK_AMOUNT: {
-                std::sort(m_Products.begin(), m_Products.end(), [sortOrder](Product* a, Product* b) {
-                    if(sortOrder == SortOrder::ASCENDING) {
-                        return a->getStockAmount() < b->getStockAmount();
-                    } else {
-                        return a->getStockAmount() > b->getStockAmount();
-                    }
-                });
-                break;
-            }
-            case SortType::ID: {
-                std::sort(m_Products.begin(), m_Products.end(), [sortOrder](Product* a, Product* b) {
-                    if(sortOrder == SortOrder::ASCENDING) {
-                        return a->getID() < b->getID();
-                    } else {
-                        return a->getID() > b->getID();
-                    }
-                });
-                break;
-            }
-            default: {
-                std::cout << "Invalid sort type" << std::endl;
-                break;
+    // Products whose name, or one of its words, is within maxDistance edits
+    // of the query (case-insensitive), closest first. The index is rebuilt on
+    // the first fuzzy search after products were added, removed or renamed;
+    // reordering the catalog leaves it alone.
+    std::vector<Product*> getProductsFuzzy(const char* query, int maxDistance = 2, size_t limit = 20) {
+        uint64_t generation = m_NameGeneration.load(std::memory_order_acquire);
+        if (m_FuzzyIndexGeneration != generation || m_FuzzyIndex.size() == 0) {
+            m_FuzzyIndex.clear();
+            for (Product* product : m_Products) {
+                m_FuzzyIndex.add(product->getID(), product->getName());
             }
+            m_FuzzyIndex.finalize();
+            m_FuzzyIndexGeneration = generation;
+        }
+
+        std::vector<Product*> products;
+        for (const FuzzyIndex::Match& match : m_FuzzyIndex.search(query, maxDistance, limit)) {
+            products.push_back(getProduct(match.productID));
+        }
+        return products;
+    }
+
+    // Bumped by every change that can alter a search result: adding or
+    // removing products, renames and reordering.
+    uint64_t getCatalogGeneration() {
+        return m_CatalogGeneration.load(std::memory_order_acquire);
+    }
+
+    void setSearchCacheEnabled(bool enabled) {
+        m_SearchCacheEnabled = enabled;
+    }
+
+    SearchCache::Stats getSearchCacheStats() {
+        return m_SearchCache.getStats();
+    }
+
+    void resetSearchCacheStats() {
+        m_SearchCache.resetStats();
+    }
+
+    // Large catalogs are sorted in chunks on g_TaskScheduler and merged.
+    // Uses the same ProductComparator as IncrementalSort, so foreground
+    // and background sorts order products identically.
+    void sortProducts(SortType sortType, SortOrder sortOrder) {
+        if (sortType != SortType::PRICE && sortType != SortType::STOCK_AMOUNT && sortType != SortType::ID) {
+            std::cout << "Invalid sort type\n";
+            return;
+        }
+
+        Parallel::Sort(m_Products.begin(), m_Products.end(), ProductComparator{sortType, sortOrder});
+        m_CatalogGeneration.fetch_add(1, std::memory_order_release);
+    }
+
+    // Replaces the catalog order with a reordered copy of the same products,
+    // e.g. the result of a background sort started at the given catalog
+    // generation. Returns false, leaving the catalog alone, if the catalog
+    // changed since then.
+    bool setProductOrder(std::vector<Product*> products, uint64_t generation) {
+        if (getCatalogGeneration() != generation || products.size() != m_Products.size()) {
+            return false;
         }
+        m_Products = std::move(products);
+        m_CatalogGeneration.fetch_add(1, std::memory_order_release);
+        return true;
     }
 
     void addProduct(Product* product) {
         product->setID(getLastProductID(true));
+        product->setCatalogGeneration(&m_CatalogGeneration, &m_NameGeneration);
         m_Products.push_back(product);
+        m_ProductsByID[product->getID()] = product;
+        m_CatalogGeneration.fetch_add(1, std::memory_order_release);
+        m_NameGeneration.fetch_add(1, std::memory_order_release);
     }
 
     void removeProduct(int ID) {
+        Product* product = m_Products[ID];
+        product->setCatalogGeneration(nullptr);
+        m_ProductsByID.erase(product->getID());
         m_Products.erase(m_Products.begin() + ID);
+        m_CatalogGeneration.fetch_add(1, std::memory_order_release);
+        m_NameGeneration.fetch_add(1, std::memory_order_release);
+    }
+
+    bool removeProductByID(int ID) {
+        auto found = std::find_if(m_Products.begin(), m_Products.end(), [ID](Product* product) {
+            return product->getID() == ID;
+        });
+        if (found == m_Products.end()) {
+            return false;
+        }
+
+        removeProduct((int)(found - m_Products.begin()));
+        return true;
     }
 
     void initDefaults() {
@@ -526,36 +2296,276 @@ class ProductManager {
     }
 
     int getLastProductID(bool increment = false) {
-        return m_LastProductID += (increment ? 1 : 0);
+        return m_LastProductID += (increment ? m_IDStride : 0);
     }
 
-    std::vector<Product*> getProducts() {
+    // A view of the catalog in its current order; invalidated by adding,
+    // removing or reordering products.
+    std::span<Product* const> getProducts() const {
         return m_Products;
-    } 
+    }
 
-    void printProducts() {
+    void printProducts(std::ostream& stream) {
         for(auto product : m_Products) {
 
             if (!product) {
                 continue;
             }
 
-            std::cout << "Product ID: " << product->getID() << std::endl;
-            std::cout << "Product Name: " << product->getName() << std::endl;
-            std::cout << "Product Price: " << product->getPrice() << std::endl;
-            std::cout << "Product Stock Amount: " << product->getStockAmount() << std::endl;
-            std::cout << "Product Description: " << product->getDescription() << std::endl;
-            std::cout << std::endl;
+            stream << "Product ID: " << product->getID() << "\n";
+            stream << "Product Name: " << product->getName() << "\n";
+            stream << "Product Price: " << product->getPrice() << "\n";
+            stream << "Product Stock Amount: " << product->getStockAmount() << "\n";
+            stream << "Product Description: " << product->getDescription() << "\n";
+            stream << "\n";
         }
     }
 
     private:
     std::vector<Product*> m_Products;
+    std::unordered_map<int, Product*> m_ProductsByID;
     int m_LastProductID;
+    int m_IDStride;
+    std::atomic<uint64_t> m_CatalogGeneration { 0 };
+    // Bumped only when the set of names changes; keys the fuzzy index.
+    std::atomic<uint64_t> m_NameGeneration { 0 };
+    SearchCache m_SearchCache;
+    FuzzyIndex m_FuzzyIndex;
+    uint64_t m_FuzzyIndexGeneration = 0;
+    bool m_SearchCacheEnabled;
 };
 
 ProductManager g_ProductManager = ProductManager();
 
+// Catalog partitioned across shards by product ID (ID % shardCount). Every
+// shard is a ProductManager owned by one worker thread and all of its
+// operations run on that thread, so shards need no locking of their own.
+// Shard s hands out the IDs s + 1, s + 1 + shardCount, ... which keeps
+// routing a single modulo. Lookups go to one shard; searches and sorted
+// listings fan out to all shards and merge the partial results.
+class ShardedProductManager {
+
+    public:
+    explicit ShardedProductManager(size_t shardCount) {
+        m_NextShard = 0;
+        for (size_t i = 0; i < shardCount; i++) {
+            m_Shards.push_back(std::make_unique<Shard>((int)i + 1, (int)shardCount));
+        }
+        for (auto& shard : m_Shards) {
+            Shard* owner = shard.get();
+            shard->worker = std::thread([owner]() {
+                owner->run();
+            });
+        }
+    }
+
+    ~ShardedProductManager() {
+        for (auto& shard : m_Shards) {
+            {
+                std::lock_guard<std::mutex> lock(shard->mutex);
+                shard->stopping = true;
+            }
+            shard->wakeup.notify_one();
+        }
+        for (auto& shard : m_Shards) {
+            shard->worker.join();
+        }
+    }
+
+    size_t getShardCount() const {
+        return m_Shards.size();
+    }
+
+    size_t shardOf(int ID) const {
+        return (size_t)(ID - 1) % m_Shards.size();
+    }
+
+    // Runs fn(ProductManager&) on the worker owning the given shard.
+    template <typename Fn>
+    auto submit(size_t shard, Fn fn) -> std::future<decltype(fn(std::declval<ProductManager&>()))> {
+        typedef decltype(fn(std::declval<ProductManager&>())) Result;
+
+        Shard& owner = *m_Shards[shard];
+        auto task = std::make_shared<std::packaged_task<Result()>>([&owner, fn]() mutable {
+            return fn(owner.products);
+        });
+        std::future<Result> result = task->get_future();
+
+        {
+            std::lock_guard<std::mutex> lock(owner.mutex);
+            owner.tasks.push_back([task]() {
+                (*task)();
+            });
+        }
+        owner.wakeup.notify_one();
+        return result;
+    }
+
+    // New products are spread round-robin; the owning shard assigns the ID.
+    std::future<int> addProduct(Product* product) {
+        size_t shard = m_NextShard.fetch_add(1, std::memory_order_relaxed) % m_Shards.size();
+        return submit(shard, [product](ProductManager& products) {
+            products.addProduct(product);
+            return product->getID();
+        });
+    }
+
+    std::future<bool> removeProduct(int ID) {
+        return submit(shardOf(ID), [ID](ProductManager& products) {
+            return products.removeProductByID(ID);
+        });
+    }
+
+    // Returns a detached copy so the caller never touches shard-owned data.
+    std::future<std::optional<Product>> getProduct(int ID) {
+        return submit(shardOf(ID), [ID](ProductManager& products) -> std::optional<Product> {
+            Product* product = products.getProduct(ID);
+            if (!product) {
+                return std::nullopt;
+            }
+            Product copy = *product;
+            copy.setCatalogGeneration(nullptr);
+            return copy;
+        });
+    }
+
+    std::future<bool> setStockAmount(int ID, int stockAmount) {
+        return submit(shardOf(ID), [ID, stockAmount](ProductManager& products) {
+            Product* product = products.getProduct(ID);
+            if (product) {
+                product->setStockAmount(stockAmount);
+            }
+            return product != nullptr;
+        });
+    }
+
+    // IDs of all products matching getProductsWithString, in shard order.
+    std::vector<int> searchProducts(const std::string& text) {
+        std::vector<std::future<std::vector<int>>> partials;
+        for (size_t shard = 0; shard < m_Shards.size(); shard++) {
+            partials.push_back(submit(shard, [text](ProductManager& products) {
+                std::vector<int> ids;
+                for (Product* product : products.getProductsWithString(text.c_str())) {
+                    ids.push_back(product->getID());
+                }
+                return ids;
+            }));
+        }
+
+        std::vector<int> ids;
+        for (auto& partial : partials) {
+            std::vector<int> part = partial.get();
+            ids.insert(ids.end(), part.begin(), part.end());
+        }
+        return ids;
+    }
+
+    // The first limit product IDs in the given order. Every shard sorts its
+    // own (key, ID) pairs and the sorted runs are merged through a heap.
+    std::vector<int> getSortedProductIDs(SortType sortType, SortOrder sortOrder, size_t limit) {
+        typedef std::pair<int, int> KeyedID;
+
+        std::vector<std::future<std::vector<KeyedID>>> partials;
+        for (size_t shard = 0; shard < m_Shards.size(); shard++) {
+            partials.push_back(submit(shard, [sortType, sortOrder, limit](ProductManager& products) {
+                std::vector<KeyedID> keyed;
+                keyed.reserve(products.getProducts().size());
+                for (Product* product : products.getProducts()) {
+                    int key = sortType == SortType::PRICE ? product->getPrice() :
+                        sortType == SortType::STOCK_AMOUNT ? product->getStockAmount() : product->getID();
+                    keyed.push_back({sortOrder == SortOrder::ASCENDING ? key : -key, product->getID()});
+                }
+
+                size_t count = std::min(limit, keyed.size());
+                std::partial_sort(keyed.begin(), keyed.begin() + count, keyed.end());
+                keyed.resize(count);
+                return keyed;
+            }));
+        }
+
+        std::vector<std::vector<KeyedID>> runs;
+        for (auto& partial : partials) {
+            runs.push_back(partial.get());
+        }
+
+        // (key, ID) of the run head, run index, position in run
+        typedef std::pair<KeyedID, std::pair<size_t, size_t>> Head;
+        std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+        for (size_t run = 0; run < runs.size(); run++) {
+            if (!runs[run].empty()) {
+                heads.push({runs[run][0], {run, 0}});
+            }
+        }
+
+        std::vector<int> ids;
+        while (!heads.empty() && ids.size() < limit) {
+            Head head = heads.top();
+            heads.pop();
+            ids.push_back(head.first.second);
+
+            size_t run = head.second.first;
+            size_t next = head.second.second + 1;
+            if (next < runs[run].size()) {
+                heads.push({runs[run][next], {run, next}});
+            }
+        }
+        return ids;
+    }
+
+    size_t size() {
+        std::vector<std::future<size_t>> partials;
+        for (size_t shard = 0; shard < m_Shards.size(); shard++) {
+            partials.push_back(submit(shard, [](ProductManager& products) {
+                return products.getProducts().size();
+            }));
+        }
+
+        size_t total = 0;
+        for (auto& partial : partials) {
+            total += partial.get();
+        }
+        return total;
+    }
+
+    private:
+    struct Shard {
+        Shard(int firstID, int idStride) : products(firstID, idStride) {
+            stopping = false;
+        }
+
+        void run() {
+            std::deque<std::function<void()>> batch;
+            for (;;) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wakeup.wait(lock, [this]() {
+                        return stopping || !tasks.empty();
+                    });
+                    if (tasks.empty()) {
+                        return;
+                    }
+                    batch.swap(tasks);
+                }
+
+                while (!batch.empty()) {
+                    batch.front()();
+                    batch.pop_front();
+                }
+            }
+        }
+
+        ProductManager products;
+        std::mutex mutex;
+        std::condition_variable wakeup;
+        std::deque<std::function<void()>> tasks;
+        bool stopping;
+        std::thread worker;
+    };
+
+    std::vector<std::unique_ptr<Shard>> m_Shards;
+    std::atomic<size_t> m_NextShard;
+};
+
 class Order {
 
     public:
@@ -622,10 +2632,10 @@ class Order {
         return (getProductCost() * getQuantity()) + m_ShippingCost;
     }
 
-    std::string getProductName() {
+    std::string_view getProductName() {
         Product* product = g_ProductManager.getProduct(m_ProductID);
         if (!product) {
-            return "";
+            return {};
         }
         return product->getName();
     }
@@ -638,391 +2648,4377 @@ class Order {
     int m_ShippingCost;
 };
 
-class Orders {  
+// Columnar, compressed storage for old orders. Rows are sealed into blocks
+// of BLOCK_SIZE; within a block every column is frame-of-reference encoded
+// (value minus the block minimum) and bit-packed at the smallest width that
+// fits. Order IDs are stored as deltas from the previous ID, which for
+// sequential IDs packs to zero bits. Each block keeps min/max per column and
+// sums of quantity and shipping cost, so totals never decode and per-product
+// scans skip blocks whose product ID range cannot match.
+class OrderArchive {
+
     public:
-    Orders() {
-        m_Orders = {};
-        m_LastOrderID = 0;
+    static constexpr size_t BLOCK_SIZE = 1024;
+
+    struct Row {
+        int orderID;
+        int productID;
+        int quantity;
+        int shippingCost;
+    };
+
+    OrderArchive() {
+        m_RowCount = 0;
     }
 
-    ~Orders() {
+    void append(const Row& row) {
+        m_Pending.push_back(row);
+        m_RowCount++;
+        if (m_Pending.size() == BLOCK_SIZE) {
+            seal();
+        }
     }
 
-    void addOrder(Order* order) {
-        order->setOrderID(getLastOrderID(true));
-        m_Orders.push_back(order);
+    size_t size() const {
+        return m_RowCount;
     }
 
-    void removeOrder(int orderID) {
-        m_Orders.erase(m_Orders.begin() + orderID);
+    size_t getBlockCount() const {
+        return m_Blocks.size();
     }
 
-    Order* getOrder(int orderID) {
-        return m_Orders[orderID];
+    size_t memoryBytes() const {
+        return m_Words.capacity() * sizeof(uint64_t) + m_Blocks.capacity() * sizeof(Block) +
+            m_Pending.capacity() * sizeof(Row) + sizeof(*this);
     }
 
-    int getLastOrderID(bool increment = false) {
-        return m_LastOrderID += (increment ? 1 : 0);
+    int64_t totalShippingCost() const {
+        int64_t total = 0;
+        for (const Block& block : m_Blocks) {
+            total += block.shippingSum;
+        }
+        for (const Row& row : m_Pending) {
+            total += row.shippingCost;
+        }
+        return total;
     }
 
-    int size() {
-        return m_Orders.size();
+    int64_t totalQuantity() const {
+        int64_t total = 0;
+        for (const Block& block : m_Blocks) {
+            total += block.quantitySum;
+        }
+        for (const Row& row : m_Pending) {
+            total += row.quantity;
+        }
+        return total;
     }
 
-    private:
-    std::vector<Order*> m_Orders;
-    int m_LastOrderID;
-};
+    // Blocks are scanned in parallel on g_TaskScheduler.
+    int64_t totalQuantityForProduct(int productID) const {
+        int64_t total = Parallel::Reduce(0, m_Blocks.size(), 64, (int64_t)0, [this, productID](size_t begin, size_t end) {
+            int64_t sum = 0;
+            for (size_t b = begin; b < end; b++) {
+                const Block& block = m_Blocks[b];
+                if (productID < block.productID.min || productID > block.productID.max) {
+                    continue;
+                }
 
-Orders g_Orders = Orders();
+                uint32_t target = (uint32_t)(productID - block.productID.min);
+                for (uint32_t i = 0; i < block.rows; i++) {
+                    if (unpack(block.productID, i) == target) {
+                        sum += block.quantity.min + (int64_t)unpack(block.quantity, i);
+                    }
+                }
+            }
+            return sum;
+        }, std::plus<int64_t>());
+        for (const Row& row : m_Pending) {
+            if (row.productID == productID) {
+                total += row.quantity;
+            }
+        }
+        return total;
+    }
 
-class ShoppingCart {
+    // Shipping cost of the orders with IDs in [firstOrderID, lastOrderID].
+    // Blocks fully inside the range use their stored sum and only blocks
+    // straddling an end are decoded.
+    int64_t shippingCostForOrderRange(int firstOrderID, int lastOrderID) const {
+        int64_t total = Parallel::Reduce(0, m_Blocks.size(), 64, (int64_t)0, [&](size_t begin, size_t end) {
+            int64_t sum = 0;
+            for (size_t b = begin; b < end; b++) {
+                const Block& block = m_Blocks[b];
+                if (block.maxOrderID < firstOrderID || block.minOrderID > lastOrderID) {
+                    continue;
+                }
 
-    public:
-    ShoppingCart() {
-        m_Cart = {};
+                if (block.minOrderID >= firstOrderID && block.maxOrderID <= lastOrderID) {
+                    sum += block.shippingSum;
+                    continue;
+                }
+
+                int orderID = block.firstOrderID;
+                for (uint32_t i = 0; i < block.rows; i++) {
+                    if (i > 0) {
+                        orderID += decode(block.orderDelta, i);
+                    }
+                    if (orderID >= firstOrderID && orderID <= lastOrderID) {
+                        sum += block.shippingCost.min + (int64_t)unpack(block.shippingCost, i);
+                    }
+                }
+            }
+            return sum;
+        }, std::plus<int64_t>());
+        for (const Row& row : m_Pending) {
+            if (row.orderID >= firstOrderID && row.orderID <= lastOrderID) {
+                total += row.shippingCost;
+            }
+        }
+        return total;
     }
 
-    ~ShoppingCart() {
+    // Decodes every row in order.
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        for (const Block& block : m_Blocks) {
+            Row row;
+            row.orderID = block.firstOrderID;
+            for (uint32_t i = 0; i < block.rows; i++) {
+                if (i > 0) {
+                    row.orderID += decode(block.orderDelta, i);
+                }
+                row.productID = decode(block.productID, i);
+                row.quantity = decode(block.quantity, i);
+                row.shippingCost = decode(block.shippingCost, i);
+                fn(row);
+            }
+        }
+        for (const Row& row : m_Pending) {
+            fn(row);
+        }
     }
 
-    bool addProductToCart(Product* product, int quantity) {
-        if (product->getStockAmount() < quantity) {
-            std::cout << "Not enough stock\n";
-            return false;
+    private:
+    struct Column {
+        int32_t min;
+        int32_t max;
+        uint32_t bits;
+        size_t offset;
+    };
+
+    struct Block {
+        uint32_t rows;
+        int32_t firstOrderID;
+        int32_t minOrderID;
+        int32_t maxOrderID;
+        Column orderDelta;
+        Column productID;
+        Column quantity;
+        Column shippingCost;
+        int64_t quantitySum;
+        int64_t shippingSum;
+    };
+
+    // Packs the pending rows into a new block.
+    void seal() {
+        if (m_Pending.empty()) {
+            return;
         }
 
-        Order* order = new Order();
-        order->setProductID(product->getID());
-        order->setQuantity(quantity);
-        m_Cart.push_back(order);
+        Block block;
+        block.rows = (uint32_t)m_Pending.size();
+        block.firstOrderID = m_Pending.front().orderID;
+        block.minOrderID = block.firstOrderID;
+        block.maxOrderID = block.firstOrderID;
+        block.quantitySum = 0;
+        block.shippingSum = 0;
+
+        std::vector<int32_t> values(m_Pending.size());
+
+        values[0] = 0;
+        for (size_t i = 1; i < m_Pending.size(); i++) {
+            values[i] = m_Pending[i].orderID - m_Pending[i - 1].orderID;
+            block.minOrderID = std::min(block.minOrderID, m_Pending[i].orderID);
+            block.maxOrderID = std::max(block.maxOrderID, m_Pending[i].orderID);
+        }
+        // The first row has no delta; keep it out of the range.
+        block.orderDelta = packColumn(values, 1);
 
-        return true;
-    }
+        for (size_t i = 0; i < m_Pending.size(); i++) {
+            values[i] = m_Pending[i].productID;
+        }
+        block.productID = packColumn(values, 0);
 
-    void removeProductFromCart(int productID) {
-        m_Cart.erase(std::remove_if(m_Cart.begin(), m_Cart.end(), [productID](Order* order) {
-            return order->getProductID() == productID;
-        }), m_Cart.end());
-    }
+        for (size_t i = 0; i < m_Pending.size(); i++) {
+            values[i] = m_Pending[i].quantity;
+            block.quantitySum += m_Pending[i].quantity;
+        }
+        block.quantity = packColumn(values, 0);
 
-    void clearCart() {
-        m_Cart.clear();
-    }
+        for (size_t i = 0; i < m_Pending.size(); i++) {
+            values[i] = m_Pending[i].shippingCost;
+            block.shippingSum += m_Pending[i].shippingCost;
+        }
+        block.shippingCost = packColumn(values, 0);
 
-    int getCartSize() {
-        return m_Cart.size();
+        m_Blocks.push_back(block);
+        m_Pending.clear();
     }
 
-    Order* getOrder(int index) {
-        return m_Cart[index];
-    }
+    Column packColumn(std::vector<int32_t>& values, size_t first) {
+        Column column;
+        column.min = 0;
+        column.max = 0;
+        if (first < values.size()) {
+            auto range = std::minmax_element(values.begin() + first, values.end());
+            column.min = *range.first;
+            column.max = *range.second;
+        }
+        if (first > 0) {
+            values[0] = column.min;
+        }
 
-    int getTotalCost() {
-        int totalCost = 0;
-        for(auto order : m_Cart) {
-            totalCost += order->getTotalCost();
+        uint32_t span = (uint32_t)column.max - (uint32_t)column.min;
+        column.bits = 0;
+        while (column.bits < 32 && (span >> column.bits) != 0) {
+            column.bits++;
         }
-        return totalCost;
-    }
 
-    void checkout() {
-        for(Order* order : m_Cart) {
-            order->setCheckedOut(true);
-            order->setShippingCost(Random::Gen(10, 100));
-            g_Orders.addOrder(order);
+        column.offset = m_Words.size() * 64;
+        if (column.bits == 0) {
+            return column;
         }
 
-        clearCart();
+        m_Words.resize(m_Words.size() + (values.size() * column.bits + 63) / 64, 0);
+        for (size_t i = 0; i < values.size(); i++) {
+            uint64_t value = (uint32_t)values[i] - (uint32_t)column.min;
+            size_t bit = column.offset + i * column.bits;
+            m_Words[bit / 64] |= value << (bit % 64);
+            if (bit % 64 + column.bits > 64) {
+                m_Words[bit / 64 + 1] |= value >> (64 - bit % 64);
+            }
+        }
+        return column;
     }
 
-    int getTotalProductCost() {
-        int totalCost = 0;
-        for(auto order : m_Cart) {
-            totalCost += order->getProductCost();
+    uint32_t unpack(const Column& column, size_t index) const {
+        if (column.bits == 0) {
+            return 0;
+        }
+
+        size_t bit = column.offset + index * column.bits;
+        uint64_t value = m_Words[bit / 64] >> (bit % 64);
+        if (bit % 64 + column.bits > 64) {
+            value |= m_Words[bit / 64 + 1] << (64 - bit % 64);
         }
-        return totalCost;
+        return (uint32_t)(value & ((1ull << column.bits) - 1));
     }
 
-    std::vector<Order*>& getCart() {
-        return m_Cart;
+    // Adds the column minimum back in unsigned arithmetic, matching packColumn,
+    // so columns spanning the whole int32 range decode without overflow.
+    int32_t decode(const Column& column, size_t index) const {
+        return (int32_t)((uint32_t)column.min + unpack(column, index));
     }
 
-    private:
-    std::vector<Order*> m_Cart;
+    std::vector<uint64_t> m_Words;
+    std::vector<Block> m_Blocks;
+    std::vector<Row> m_Pending;
+    size_t m_RowCount;
 };
 
-ShoppingCart g_ShoppingCart = ShoppingCart();
-
-void clear() {
-    std::cout << "\033[2J\033[1;1H";
-}
+// Shared by every shopping session and the archiving timer, so every access
+// takes the lock. Live orders stay sorted by order ID. getOrder hands out a
+// raw pointer that is only safe to use while no other thread removes or
+// archives orders.
+class Orders {  
+    public:
+    Orders() {
+        m_Orders = {};
+        m_LastOrderID = 0;
+    }
+
+    ~Orders() {
+    }
+
+    void addOrder(Order* order) {
+        TRACE_SCOPE("Orders::addOrder");
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        order->setOrderID(++m_LastOrderID);
+        m_Orders.push_back(order);
+    }
+
+    // Adds a whole cart under one lock; the orders get consecutive IDs. Each
+    // order still gets its own Orders::addOrder span inside the batch span.
+    void addOrders(const std::vector<Order*>& orders) {
+        TRACE_SCOPE("Orders::addOrders");
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        for (Order* order : orders) {
+            TRACE_SCOPE("Orders::addOrder");
+            order->setOrderID(++m_LastOrderID);
+            m_Orders.push_back(order);
+        }
+    }
+
+    // Removes and frees the live order with this order ID. Returns false if
+    // there is none, e.g. because the ID is unknown or already archived.
+    bool removeOrder(int orderID) {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        auto found = std::lower_bound(m_Orders.begin(), m_Orders.end(), orderID, [](Order* order, int ID) {
+            return order->getOrderID() < ID;
+        });
+        if (found == m_Orders.end() || (*found)->getOrderID() != orderID) {
+            return false;
+        }
+        delete *found;
+        m_Orders.erase(found);
+        return true;
+    }
+
+    // The index-th live order, oldest first. Archiving shifts the indices.
+    Order* getOrder(int index) {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_Orders[index];
+    }
+
+    // Calls fn for every live order, oldest first, under one lock.
+    template <typename Fn>
+    void forEachOrder(Fn fn) {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        for (Order* order : m_Orders) {
+            fn(order);
+        }
+    }
+
+    int getLastOrderID(bool increment = false) {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_LastOrderID += (increment ? 1 : 0);
+    }
+
+    int size() {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_Orders.size();
+    }
+
+    // Moves all but the newest keepLive orders into the archive and frees
+    // them. Returns the number of orders archived.
+    size_t archiveOrders(size_t keepLive) {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (m_Orders.size() <= keepLive) {
+            return 0;
+        }
+
+        size_t count = m_Orders.size() - keepLive;
+        for (size_t i = 0; i < count; i++) {
+            Order* order = m_Orders[i];
+            m_Archive.append({order->getOrderID(), order->getProductID(), order->getQuantity(), order->getShippingCost()});
+            delete order;
+        }
+        m_Orders.erase(m_Orders.begin(), m_Orders.begin() + count);
+        m_Orders.shrink_to_fit();
+        return count;
+    }
+
+    const OrderArchive& getArchive() {
+        return m_Archive;
+    }
+
+    // Bytes held by the vector of live order pointers. The orders themselves
+    // are separate allocations and not included.
+    size_t liveIndexBytes() {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_Orders.capacity() * sizeof(Order*);
+    }
+
+    private:
+    std::mutex m_Mutex;
+    std::vector<Order*> m_Orders;
+    int m_LastOrderID;
+    OrderArchive m_Archive;
+};
+
+Orders g_Orders = Orders();
+
+struct CartLine {
+    int productID;
+    int quantity;
+};
+
+enum class CartLineStatus {
+    OK,
+    UNKNOWN_PRODUCT,
+    INVALID_QUANTITY,
+    INSUFFICIENT_STOCK
+};
+
+struct CartLineResult {
+    int productID;
+    int quantity;
+    CartLineStatus status;
+};
+
+class ShoppingCart {
+
+    public:
+    // Carts up to this many lines are totalled inline.
+    static constexpr size_t AGGREGATE_GRAIN = 4096;
+
+    ShoppingCart() {
+        m_Cart = {};
+    }
+
+    ~ShoppingCart() {
+    }
+
+    bool addProductToCart(Product* product, int quantity) {
+        TRACE_SCOPE("ShoppingCart::addProductToCart");
+        {
+            TRACE_SCOPE("ShoppingCart::stockCheck");
+            if (product->getStockAmount() < quantity) {
+                return false;
+            }
+        }
+
+        Order* order = new Order();
+        order->setProductID(product->getID());
+        order->setQuantity(quantity);
+        m_Cart.push_back(order);
+
+        return true;
+    }
+
+    // Removes and frees every cart line for the product.
+    void removeProductFromCart(int productID) {
+        removeLinesIf([productID](int lineProductID) {
+            return lineProductID == productID;
+        });
+    }
+
+    // Adds many lines in one call: one pass resolves every line through the
+    // catalog's ID index, stock is then checked for all lines in a single
+    // branch-free loop (each line on its own, as addProductToCart does) and
+    // the cart grows once. Returns one result per line, in input order;
+    // failed lines are not added.
+    std::vector<CartLineResult> addProductsToCart(const std::vector<CartLine>& lines, ProductManager& productManager = g_ProductManager) {
+        TRACE_SCOPE("ShoppingCart::addProductsToCart");
+
+        size_t count = lines.size();
+        std::vector<Product*> products(count);
+        std::vector<int> stock(count);
+        std::vector<int> quantity(count);
+        for (size_t i = 0; i < count; i++) {
+            products[i] = productManager.getProduct(lines[i].productID);
+            stock[i] = products[i] ? products[i]->getStockAmount() : 0;
+            quantity[i] = lines[i].quantity;
+        }
+
+        std::vector<uint8_t> inStock(count);
+        {
+            TRACE_SCOPE("ShoppingCart::stockCheck");
+            for (size_t i = 0; i < count; i++) {
+                inStock[i] = (uint8_t)(quantity[i] > 0 && quantity[i] <= stock[i]);
+            }
+        }
+
+        std::vector<CartLineResult> results(count);
+        m_Cart.reserve(m_Cart.size() + count);
+        for (size_t i = 0; i < count; i++) {
+            CartLineResult& result = results[i];
+            result.productID = lines[i].productID;
+            result.quantity = lines[i].quantity;
+
+            if (!products[i]) {
+                result.status = CartLineStatus::UNKNOWN_PRODUCT;
+            } else if (quantity[i] <= 0) {
+                result.status = CartLineStatus::INVALID_QUANTITY;
+            } else if (!inStock[i]) {
+                result.status = CartLineStatus::INSUFFICIENT_STOCK;
+            } else {
+                result.status = CartLineStatus::OK;
+
+                Order* order = new Order();
+                order->setProductID(lines[i].productID);
+                order->setQuantity(lines[i].quantity);
+                m_Cart.push_back(order);
+            }
+        }
+
+        return results;
+    }
+
+    // Removes and frees every cart line for any of the given products in a
+    // single compaction pass. Returns the number of lines removed.
+    size_t removeProductsFromCart(std::vector<int> productIDs) {
+        std::sort(productIDs.begin(), productIDs.end());
+
+        return removeLinesIf([&productIDs](int lineProductID) {
+            return std::binary_search(productIDs.begin(), productIDs.end(), lineProductID);
+        });
+    }
+
+    void clearCart() {
+        m_Cart.clear();
+    }
+
+    int getCartSize() {
+        return m_Cart.size();
+    }
+
+    Order* getOrder(int index) {
+        return m_Cart[index];
+    }
+
+    int getTotalCost() {
+        return Parallel::Reduce(0, m_Cart.size(), AGGREGATE_GRAIN, 0, [this](size_t begin, size_t end) {
+            int totalCost = 0;
+            for (size_t i = begin; i < end; i++) {
+                totalCost += m_Cart[i]->getTotalCost();
+            }
+            return totalCost;
+        }, std::plus<int>());
+    }
+
+    void checkout() {
+        TRACE_SCOPE("ShoppingCart::checkout");
+        for(Order* order : m_Cart) {
+            order->setCheckedOut(true);
+            {
+                TRACE_SCOPE("Random::Gen shipping cost");
+                order->setShippingCost(Random::Gen(10, 100));
+            }
+        }
+        g_Orders.addOrders(m_Cart);
+
+        clearCart();
+    }
+
+    int getTotalProductCost() {
+        return Parallel::Reduce(0, m_Cart.size(), AGGREGATE_GRAIN, 0, [this](size_t begin, size_t end) {
+            int totalCost = 0;
+            for (size_t i = begin; i < end; i++) {
+                totalCost += m_Cart[i]->getProductCost();
+            }
+            return totalCost;
+        }, std::plus<int>());
+    }
+
+    std::vector<Order*>& getCart() {
+        return m_Cart;
+    }
+
+    private:
+    // The cart owns its lines until checkout hands them to g_Orders, so
+    // both remove paths free what they take out.
+    template <typename Matches>
+    size_t removeLinesIf(Matches matches) {
+        size_t before = m_Cart.size();
+        m_Cart.erase(std::remove_if(m_Cart.begin(), m_Cart.end(), [&matches](Order* order) {
+            if (!matches(order->getProductID())) {
+                return false;
+            }
+            delete order;
+            return true;
+        }), m_Cart.end());
+
+        return before - m_Cart.size();
+    }
+
+    std::vector<Order*> m_Cart;
+};
+
+ShoppingCart g_ShoppingCart = ShoppingCart();
+
+// Streaming columnar export for offline analytics. Column values are
+// appended straight into per-column buffers and written out in batches of a
+// fixed row count, so there is no per-row formatting.
+//
+// File layout (little-endian, every section padded to 8 bytes):
+//
+//   header   "CDCOL001"
+//            u32 column count, u32 rows per batch
+//            per column: u8 type (1 = int32, 2 = utf8), u8 name length, name
+//   batch    u32 row count, u32 reserved
+//            per column, in header order:
+//              int32  row count values
+//              utf8   row count + 1 int32 offsets into the data, then the data
+//   footer   u64 offset of every batch, u64 batch count, u64 total rows,
+//            "CDCOLEND"
+//
+// A reader seeks to the last 24 bytes, then to the batch offsets. Column
+// buffers have the same shape as Arrow's fixed-width and variable-width
+// string arrays, so converting to Arrow IPC is a copy-free re-framing.
+class ColumnarWriter {
+
+    public:
+    enum class ColumnType : uint8_t {
+        INT32 = 1,
+        UTF8 = 2
+    };
+
+    struct Column {
+        std::string name;
+        ColumnType type;
+    };
+
+    explicit ColumnarWriter(uint32_t batchRows = 65536) {
+        m_File = nullptr;
+        m_BatchRows = batchRows;
+        m_Rows = 0;
+        m_TotalRows = 0;
+        m_Offset = 0;
+    }
+
+    ~ColumnarWriter() {
+        close();
+    }
+
+    bool open(const char* path, std::vector<Column> columns) {
+        close();
+
+        m_File = std::fopen(path, "wb");
+        if (!m_File) {
+            return false;
+        }
+
+        m_Columns = std::move(columns);
+        m_Buffers.assign(m_Columns.size(), ColumnBuffer());
+        m_BatchOffsets.clear();
+        m_Rows = 0;
+        m_TotalRows = 0;
+        m_Offset = 0;
+
+        m_Scratch.clear();
+        append("CDCOL001", 8);
+        appendValue((uint32_t)m_Columns.size());
+        appendValue(m_BatchRows);
+        for (const Column& column : m_Columns) {
+            appendValue((uint8_t)column.type);
+            appendValue((uint8_t)column.name.size());
+            append(column.name.data(), column.name.size());
+        }
+        pad();
+        return flushScratch();
+    }
+
+    void appendInt(size_t column, int32_t value) {
+        m_Buffers[column].values.push_back(value);
+    }
+
+    void appendString(size_t column, std::string_view value) {
+        ColumnBuffer& buffer = m_Buffers[column];
+        if (buffer.values.empty()) {
+            buffer.values.push_back(0);
+        }
+        buffer.data.append(value.data(), value.size());
+        buffer.values.push_back((int32_t)buffer.data.size());
+    }
+
+    // Call once every column has a value for the current row.
+    bool endRow() {
+        if (++m_Rows == m_BatchRows) {
+            return writeBatch();
+        }
+        return true;
+    }
+
+    bool close() {
+        if (!m_File) {
+            return true;
+        }
+
+        bool ok = writeBatch();
+
+        m_Scratch.clear();
+        for (uint64_t offset : m_BatchOffsets) {
+            appendValue(offset);
+        }
+        appendValue((uint64_t)m_BatchOffsets.size());
+        appendValue(m_TotalRows);
+        append("CDCOLEND", 8);
+        ok = flushScratch() && ok;
+
+        ok = std::fclose(m_File) == 0 && ok;
+        m_File = nullptr;
+        return ok;
+    }
+
+    uint64_t getBytesWritten() const {
+        return m_Offset;
+    }
+
+    private:
+    // int32 columns use values directly; utf8 columns keep offsets in values.
+    struct ColumnBuffer {
+        std::vector<int32_t> values;
+        std::string data;
+    };
+
+    bool writeBatch() {
+        if (m_Rows == 0) {
+            return true;
+        }
+
+        m_BatchOffsets.push_back(m_Offset);
+
+        m_Scratch.clear();
+        appendValue(m_Rows);
+        appendValue((uint32_t)0);
+        bool ok = flushScratch();
+
+        for (size_t i = 0; i < m_Columns.size(); i++) {
+            ColumnBuffer& buffer = m_Buffers[i];
+            ok = writeRaw(buffer.values.data(), buffer.values.size() * sizeof(int32_t)) && ok;
+            if (m_Columns[i].type == ColumnType::UTF8) {
+                ok = writeRaw(buffer.data.data(), buffer.data.size()) && ok;
+            }
+            buffer.values.clear();
+            buffer.data.clear();
+        }
+
+        m_TotalRows += m_Rows;
+        m_Rows = 0;
+        return ok;
+    }
+
+    bool writeRaw(const void* data, size_t size) {
+        static const char zeros[8] = {};
+        size_t padding = (8 - size % 8) % 8;
+        bool ok = std::fwrite(data, 1, size, m_File) == size && std::fwrite(zeros, 1, padding, m_File) == padding;
+        m_Offset += size + padding;
+        return ok;
+    }
+
+    void append(const char* data, size_t size) {
+        m_Scratch.append(data, size);
+    }
+
+    template <typename T>
+    void appendValue(T value) {
+        append((const char*)&value, sizeof(value));
+    }
+
+    void pad() {
+        m_Scratch.append((8 - m_Scratch.size() % 8) % 8, '\0');
+    }
+
+    bool flushScratch() {
+        pad();
+        bool ok = std::fwrite(m_Scratch.data(), 1, m_Scratch.size(), m_File) == m_Scratch.size();
+        m_Offset += m_Scratch.size();
+        return ok;
+    }
+
+    std::FILE* m_File;
+    std::vector<Column> m_Columns;
+    std::vector<ColumnBuffer> m_Buffers;
+    std::vector<uint64_t> m_BatchOffsets;
+    std::string m_Scratch;
+    uint32_t m_BatchRows;
+    uint32_t m_Rows;
+    uint64_t m_TotalRows;
+    uint64_t m_Offset;
+};
+
+bool exportCatalogColumnar(const char* path, ProductManager& productManager)
+{
+    ColumnarWriter writer;
+    if (!writer.open(path, {
+        {"id", ColumnarWriter::ColumnType::INT32},
+        {"name", ColumnarWriter::ColumnType::UTF8},
+        {"price", ColumnarWriter::ColumnType::INT32},
+        {"stock_amount", ColumnarWriter::ColumnType::INT32},
+        {"description", ColumnarWriter::ColumnType::UTF8}})) {
+        return false;
+    }
+
+    bool ok = true;
+    for (Product* product : productManager.getProducts()) {
+        writer.appendInt(0, product->getID());
+        writer.appendString(1, product->getName());
+        writer.appendInt(2, product->getPrice());
+        writer.appendInt(3, product->getStockAmount());
+        writer.appendString(4, product->getDescription());
+        ok = writer.endRow() && ok;
+    }
+    return writer.close() && ok;
+}
+
+// Archived orders first, then the live ones, both in order ID order.
+bool exportOrdersColumnar(const char* path, Orders& orders)
+{
+    ColumnarWriter writer;
+    if (!writer.open(path, {
+        {"order_id", ColumnarWriter::ColumnType::INT32},
+        {"product_id", ColumnarWriter::ColumnType::INT32},
+        {"quantity", ColumnarWriter::ColumnType::INT32},
+        {"shipping_cost", ColumnarWriter::ColumnType::INT32},
+        {"archived", ColumnarWriter::ColumnType::INT32}})) {
+        return false;
+    }
+
+    bool ok = true;
+    orders.getArchive().forEach([&](const OrderArchive::Row& row) {
+        writer.appendInt(0, row.orderID);
+        writer.appendInt(1, row.productID);
+        writer.appendInt(2, row.quantity);
+        writer.appendInt(3, row.shippingCost);
+        writer.appendInt(4, 1);
+        ok = writer.endRow() && ok;
+    });
+
+    orders.forEachOrder([&](Order* order) {
+        writer.appendInt(0, order->getOrderID());
+        writer.appendInt(1, order->getProductID());
+        writer.appendInt(2, order->getQuantity());
+        writer.appendInt(3, order->getShippingCost());
+        writer.appendInt(4, 0);
+        ok = writer.endRow() && ok;
+    });
+    return writer.close() && ok;
+}
+
+// Prints the schema and row counts of a columnar export file.
+int printColumnarInfo(const char* path)
+{
+    std::ifstream file(path, std::ios::binary);
+    char magic[8];
+    uint32_t columnCount = 0;
+    uint32_t batchRows = 0;
+    if (!file.read(magic, 8) || std::string(magic, 8) != "CDCOL001" ||
+        !file.read((char*)&columnCount, 4) || !file.read((char*)&batchRows, 4)) {
+        std::cout << path << ": not a columnar export\n";
+        return 1;
+    }
+
+    std::cout << path << ": " << columnCount << " columns, " << batchRows << " rows per batch\n";
+    for (uint32_t i = 0; i < columnCount; i++) {
+        uint8_t type = 0;
+        uint8_t length = 0;
+        file.read((char*)&type, 1);
+        file.read((char*)&length, 1);
+        std::string name(length, '\0');
+        file.read(&name[0], length);
+        std::cout << "  " << name << " (" << (type == 1 ? "int32" : "utf8") << ")\n";
+    }
+
+    uint64_t batches = 0;
+    uint64_t rows = 0;
+    file.seekg(-24, std::ios::end);
+    file.read((char*)&batches, 8);
+    file.read((char*)&rows, 8);
+    file.read(magic, 8);
+    if (!file || std::string(magic, 8) != "CDCOLEND") {
+        std::cout << "  missing footer\n";
+        return 1;
+    }
+
+    std::cout << "  " << rows << " rows in " << batches << " batches\n";
+    return 0;
+}
+
+// Reusable output buffer. Appending never shrinks the string, so once it has
+// grown to the size of the largest screen rendering allocates nothing.
+class FrameBuffer : public std::streambuf {
+
+    public:
+    FrameBuffer() : m_Stream(this) {
+    }
+
+    std::ostream& stream() {
+        return m_Stream;
+    }
+
+    const std::string& str() const {
+        return m_Buffer;
+    }
+
+    bool empty() const {
+        return m_Buffer.empty();
+    }
+
+    void clear() {
+        m_Buffer.clear();
+    }
+
+    protected:
+    int_type overflow(int_type ch) override {
+        if (ch != traits_type::eof()) {
+            m_Buffer.push_back((char)ch);
+        }
+        return ch;
+    }
+
+    std::streamsize xsputn(const char* data, std::streamsize count) override {
+        m_Buffer.append(data, (size_t)count);
+        return count;
+    }
+
+    private:
+    std::string m_Buffer;
+    std::ostream m_Stream;
+};
+
+inline bool writeToFd(int fd, const char* data, size_t size, uint64_t& writeCalls) {
+    while (size > 0) {
+#ifdef _WIN32
+        int written = _write(fd, data, (unsigned int)std::min<size_t>(size, INT_MAX));
+#else
+        ssize_t written = ::write(fd, data, size);
+#endif
+        writeCalls++;
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+// All screen output goes through here. A screen opens a frame, renders into
+// the frame buffer and the frame is sent with a single write when the screen
+// next waits for input. With diffing enabled (TERMINAL_DIFF=1) only lines that
+// differ from what is already on screen are redrawn. TERMINAL_STATS=1 prints
+// syscall and frame time counters on exit.
+class Terminal {
+
+    public:
+    struct Stats {
+        uint64_t frames = 0;
+        uint64_t writeCalls = 0;
+        uint64_t bytes = 0;
+        uint64_t linesRedrawn = 0;
+        double lastFrameMs = 0;
+        double totalFrameMs = 0;
+    };
+
+    Terminal() {
+        m_Fd = 1;
+        m_Rows = 0;
+        m_DiffEnabled = false;
+        m_FrameOpen = false;
+        m_HasScreen = false;
+    }
+
+    void setOutput(int fd) {
+        m_Fd = fd;
+        m_HasScreen = false;
+    }
+
+    // Row count used to decide whether a frame fits for diffing when the
+    // output is not a terminal that can be asked.
+    void setTerminalRows(int rows) {
+        m_Rows = rows;
+    }
+
+    void setDiffEnabled(bool enabled) {
+        m_DiffEnabled = enabled;
+        m_HasScreen = false;
+    }
+
+    std::ostream& out() {
+        return m_Buffer.stream();
+    }
+
+    std::ostream& beginFrame() {
+        if (!m_Buffer.empty()) {
+            flush();
+        }
+
+        m_FrameOpen = true;
+        m_FrameStart = std::chrono::steady_clock::now();
+        return out();
+    }
+
+    void flush() {
+        if (m_FrameOpen) {
+            present();
+        } else if (!m_Buffer.empty()) {
+            send(m_Buffer.str());
+            if (m_DiffEnabled) {
+                m_Screen += m_Buffer.str();
+            }
+        }
+
+        m_Buffer.clear();
+    }
+
+    // Lines typed by the user are echoed by the terminal, so they count as
+    // screen contents for the next diff.
+    void noteInput(const std::string& line) {
+        if (m_DiffEnabled) {
+            m_Screen += line;
+            m_Screen += '\n';
+        }
+    }
+
+    const Stats& getStats() const {
+        return m_Stats;
+    }
+
+    void printStats(std::ostream& stream) const {
+        stream << "Frames: " << m_Stats.frames << ", write calls: " << m_Stats.writeCalls
+               << ", bytes: " << m_Stats.bytes << ", lines redrawn: " << m_Stats.linesRedrawn
+               << ", last frame: " << m_Stats.lastFrameMs << " ms, average frame: "
+               << (m_Stats.frames ? m_Stats.totalFrameMs / m_Stats.frames : 0.0) << " ms\n";
+    }
+
+    private:
+    static size_t countLines(const std::string& text) {
+        return (size_t)std::count(text.begin(), text.end(), '\n');
+    }
+
+    int terminalRows() const {
+        if (m_Rows > 0) {
+            return m_Rows;
+        }
+#if defined(TIOCGWINSZ)
+        struct winsize size;
+        if (ioctl(m_Fd, TIOCGWINSZ, &size) == 0) {
+            return size.ws_row;
+        }
+#endif
+        return 0;
+    }
+
+    void present() {
+        const std::string& frame = m_Buffer.str();
+        m_Output.clear();
+
+        size_t rows = (size_t)terminalRows();
+        bool diff = m_DiffEnabled && m_HasScreen && countLines(frame) < rows && countLines(m_Screen) < rows;
+
+        if (diff) {
+            appendDiff(frame);
+        } else {
+            m_Output += "\033[2J\033[1;1H";
+            m_Output += frame;
+            m_Stats.linesRedrawn += countLines(frame);
+        }
+
+        send(m_Output);
+
+        if (m_DiffEnabled) {
+            m_Screen.assign(frame);
+            m_HasScreen = true;
+        }
+
+        m_FrameOpen = false;
+        m_Stats.frames++;
+        m_Stats.lastFrameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_FrameStart).count();
+        m_Stats.totalFrameMs += m_Stats.lastFrameMs;
+    }
+
+    // Redraws changed lines in place, then clears everything below the new
+    // frame and leaves the cursor where the frame text ends.
+    void appendDiff(const std::string& frame) {
+        size_t framePos = 0;
+        size_t screenPos = 0;
+        size_t row = 1;
+
+        while (framePos < frame.size()) {
+            size_t frameEnd = frame.find('\n', framePos);
+            bool lastLine = frameEnd == std::string::npos;
+            if (lastLine) {
+                frameEnd = frame.size();
+            }
+
+            size_t screenEnd = screenPos < m_Screen.size() ? m_Screen.find('\n', screenPos) : std::string::npos;
+            bool sameLine = screenEnd != std::string::npos && !lastLine &&
+                m_Screen.compare(screenPos, screenEnd - screenPos, frame, framePos, frameEnd - framePos) == 0;
+
+            if (!sameLine) {
+                m_Output += "\033[" + std::to_string(row) + ";1H";
+                m_Output.append(frame, framePos, frameEnd - framePos);
+                m_Output += "\033[K";
+                m_Stats.linesRedrawn++;
+            }
+
+            screenPos = screenEnd == std::string::npos ? m_Screen.size() : screenEnd + 1;
+            framePos = frameEnd + 1;
+
+            if (lastLine) {
+                m_Output += "\033[J";
+                return;
+            }
+
+            row++;
+        }
+
+        m_Output += "\033[" + std::to_string(row) + ";1H\033[J";
+    }
+
+    void send(const std::string& data) {
+        writeToFd(m_Fd, data.data(), data.size(), m_Stats.writeCalls);
+        m_Stats.bytes += data.size();
+    }
+
+    FrameBuffer m_Buffer;
+    std::string m_Output;
+    std::string m_Screen;
+    std::chrono::steady_clock::time_point m_FrameStart;
+    Stats m_Stats;
+    int m_Fd;
+    int m_Rows;
+    bool m_DiffEnabled;
+    bool m_FrameOpen;
+    bool m_HasScreen;
+};
+
+Terminal g_Terminal = Terminal();
+
+// Single-threaded event loop for the interactive UI. While a screen waits for
+// a line of input the loop keeps running posted tasks, periodic timers and
+// incremental background jobs, waking on stdin with epoll where available.
+class EventLoop {
+
+    public:
+    typedef std::function<void()> Task;
+    // A background job does a bounded slice of work per call and returns
+    // false once it has finished.
+    typedef std::function<bool()> Job;
+
+    // Reads input lines from inputFd, which is stdin for the UI.
+    explicit EventLoop(int inputFd = 0) {
+        m_InputFd = inputFd;
+        m_NextTimerID = 0;
+        m_InputClosed = false;
+        m_Epoll = -1;
+        m_Pollable = false;
+#if defined(__linux__)
+        m_Epoll = epoll_create1(EPOLL_CLOEXEC);
+        if (m_Epoll >= 0) {
+            struct epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.fd = m_InputFd;
+            // Fails with EPERM when stdin is a regular file, which is always
+            // readable anyway.
+            m_Pollable = epoll_ctl(m_Epoll, EPOLL_CTL_ADD, m_InputFd, &event) == 0;
+        }
+#endif
+    }
+
+    ~EventLoop() {
+#if defined(__linux__)
+        if (m_Epoll >= 0) {
+            close(m_Epoll);
+        }
+#endif
+    }
+
+    void post(Task task) {
+        m_Tasks.push_back(std::move(task));
+    }
+
+    int addTimer(std::chrono::milliseconds interval, Task task) {
+        Timer timer;
+        timer.id = ++m_NextTimerID;
+        timer.interval = interval;
+        timer.deadline = std::chrono::steady_clock::now() + interval;
+        timer.task = std::move(task);
+        m_Timers.push_back(std::move(timer));
+        return m_NextTimerID;
+    }
+
+    void cancelTimer(int id) {
+        m_Timers.erase(std::remove_if(m_Timers.begin(), m_Timers.end(), [id](const Timer& timer) {
+            return timer.id == id;
+        }), m_Timers.end());
+    }
+
+    void addJob(Job job) {
+        m_Jobs.push_back(std::move(job));
+    }
+
+    bool hasPendingWork() const {
+        return !m_Tasks.empty() || !m_Jobs.empty();
+    }
+
+    bool isInputClosed() const {
+        return m_InputClosed;
+    }
+
+    // Runs background work until a full line is available on stdin. Returns
+    // false once input has ended.
+    bool waitForLine(std::string& line) {
+        for (;;) {
+            if (takeLine(line)) {
+                return true;
+            }
+
+            if (m_InputClosed) {
+                if (m_InputBuffer.empty()) {
+                    return false;
+                }
+                line.swap(m_InputBuffer);
+                m_InputBuffer.clear();
+                return true;
+            }
+
+            runOnce();
+        }
+    }
+
+    // One loop iteration: tasks, due timers, a slice of background jobs, then
+    // wait for input (without blocking if jobs remain).
+    void runOnce() {
+        runTasks();
+        runTimers();
+        runJobs();
+
+        if (!m_Pollable) {
+            if (hasPendingWork()) {
+                return;
+            }
+            readInput();
+            return;
+        }
+
+#if defined(__linux__)
+        int timeout = hasPendingWork() ? 0 : nextTimeoutMs();
+        struct epoll_event event;
+        int ready = epoll_wait(m_Epoll, &event, 1, timeout);
+        if (ready > 0) {
+            readInput();
+        }
+#endif
+    }
+
+    private:
+    struct Timer {
+        int id;
+        std::chrono::milliseconds interval;
+        std::chrono::steady_clock::time_point deadline;
+        Task task;
+    };
+
+    bool takeLine(std::string& line) {
+        size_t newline = m_InputBuffer.find('\n');
+        if (newline == std::string::npos) {
+            return false;
+        }
+        line.assign(m_InputBuffer, 0, newline);
+        m_InputBuffer.erase(0, newline + 1);
+        return true;
+    }
+
+    void readInput() {
+#if defined(_WIN32)
+        std::string line;
+        if (std::getline(std::cin, line)) {
+            m_InputBuffer += line;
+            m_InputBuffer += '\n';
+        } else {
+            m_InputClosed = true;
+        }
+#else
+        char buffer[4096];
+        ssize_t count = read(m_InputFd, buffer, sizeof(buffer));
+        if (count > 0) {
+            m_InputBuffer.append(buffer, (size_t)count);
+        } else if (count == 0 || errno != EINTR) {
+            m_InputClosed = true;
+        }
+#endif
+    }
+
+    void runTasks() {
+        while (!m_Tasks.empty()) {
+            Task task = std::move(m_Tasks.front());
+            m_Tasks.pop_front();
+            task();
+        }
+    }
+
+    // Fires due timers earliest deadline first. A callback may add or cancel
+    // timers; one cancelled before its turn does not fire.
+    void runTimers() {
+        auto now = std::chrono::steady_clock::now();
+        std::vector<std::pair<std::chrono::steady_clock::time_point, int>> due;
+        for (const Timer& timer : m_Timers) {
+            if (timer.deadline <= now) {
+                due.emplace_back(timer.deadline, timer.id);
+            }
+        }
+        std::sort(due.begin(), due.end());
+
+        for (const auto& [deadline, id] : due) {
+            auto timer = std::find_if(m_Timers.begin(), m_Timers.end(), [id = id](const Timer& timer) {
+                return timer.id == id;
+            });
+            if (timer == m_Timers.end()) {
+                continue;
+            }
+            timer->deadline = now + timer->interval;
+            Task task = timer->task;
+            task();
+        }
+    }
+
+    // Steps jobs round-robin for about one time slice so input stays responsive.
+    void runJobs() {
+        auto sliceEnd = std::chrono::steady_clock::now() + std::chrono::milliseconds(5);
+        while (!m_Jobs.empty() && std::chrono::steady_clock::now() < sliceEnd) {
+            Job job = std::move(m_Jobs.front());
+            m_Jobs.pop_front();
+            if (job()) {
+                m_Jobs.push_back(std::move(job));
+            }
+        }
+    }
+
+    int nextTimeoutMs() const {
+        if (m_Timers.empty()) {
+            return -1;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        auto next = m_Timers.front().deadline;
+        for (const Timer& timer : m_Timers) {
+            next = std::min(next, timer.deadline);
+        }
+
+        if (next <= now) {
+            return 0;
+        }
+        return (int)std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count() + 1;
+    }
+
+    std::deque<Task> m_Tasks;
+    std::deque<Job> m_Jobs;
+    std::vector<Timer> m_Timers;
+    std::string m_InputBuffer;
+    int m_InputFd;
+    int m_NextTimerID;
+    bool m_InputClosed;
+    int m_Epoll;
+    bool m_Pollable;
+};
+
+EventLoop g_EventLoop;
+
+// Sorts a snapshot of the catalog a slice at a time: fixed-size runs are
+// sorted first, then merged pairwise bottom-up. The result is published back
+// to the ProductManager in one step when the sort completes, unless the
+// catalog changed while it ran, in which case it is discarded.
+class IncrementalSort {
+
+    public:
+    static constexpr size_t RUN_SIZE = 1 << 14;
+
+    IncrementalSort(ProductManager& productManager, SortType sortType, SortOrder sortOrder)
+        : m_ProductManager(productManager), m_Products(productManager.getProducts().begin(), productManager.getProducts().end()), m_Comparator{sortType, sortOrder} {
+        m_Generation = productManager.getCatalogGeneration();
+        m_Applied = false;
+        m_Width = RUN_SIZE;
+        m_Position = 0;
+        m_Done = 0;
+        m_Total = 0;
+
+        size_t runs = (m_Products.size() + RUN_SIZE - 1) / RUN_SIZE;
+        m_Total = runs;
+        for (size_t width = RUN_SIZE; width < m_Products.size(); width *= 2) {
+            m_Total += (m_Products.size() + 2 * width - 1) / (2 * width);
+        }
+    }
+
+    // Does one run sort or one merge. Returns false when the sort is done.
+    bool step() {
+        size_t size = m_Products.size();
+
+        if (m_Position < size && m_Width == RUN_SIZE && m_Done < (size + RUN_SIZE - 1) / RUN_SIZE) {
+            size_t end = std::min(size, m_Position + RUN_SIZE);
+            std::sort(m_Products.begin() + m_Position, m_Products.begin() + end, m_Comparator);
+            m_Position = end;
+            m_Done++;
+            if (m_Position >= size) {
+                m_Position = 0;
+            }
+            return true;
+        }
+
+        if (m_Width >= size) {
+            m_Applied = m_ProductManager.setProductOrder(std::move(m_Products), m_Generation);
+            return false;
+        }
+
+        size_t middle = std::min(size, m_Position + m_Width);
+        size_t end = std::min(size, m_Position + 2 * m_Width);
+        std::inplace_merge(m_Products.begin() + m_Position, m_Products.begin() + middle, m_Products.begin() + end, m_Comparator);
+        m_Done++;
+
+        m_Position = end;
+        if (m_Position >= size) {
+            m_Position = 0;
+            m_Width *= 2;
+        }
+        return true;
+    }
+
+    int getProgressPercent() const {
+        return m_Total ? (int)(m_Done * 100 / m_Total) : 100;
+    }
+
+    // Whether the finished sort replaced the catalog order.
+    bool wasApplied() const {
+        return m_Applied;
+    }
+
+    private:
+    ProductManager& m_ProductManager;
+    std::vector<Product*> m_Products;
+    ProductComparator m_Comparator;
+    uint64_t m_Generation;
+    bool m_Applied;
+    size_t m_Width;
+    size_t m_Position;
+    size_t m_Done;
+    size_t m_Total;
+};
+
+// Catalogs at least this large are sorted in the background.
+static const size_t ASYNC_SORT_THRESHOLD = 100000;
+
+bool g_BackgroundSortRunning = false;
+
+// Returns false without starting anything if a background sort is still
+// pending; only one may run at a time.
+bool startBackgroundSort(SortType sortType, SortOrder sortOrder)
+{
+    if (g_BackgroundSortRunning) {
+        return false;
+    }
+    g_BackgroundSortRunning = true;
+
+    auto sort = std::make_shared<IncrementalSort>(g_ProductManager, sortType, sortOrder);
+    auto reported = std::make_shared<int>(0);
+
+    g_EventLoop.addJob([sort, reported]() {
+        bool running = sort->step();
+        int progress = sort->getProgressPercent();
+
+        if (!running) {
+            g_BackgroundSortRunning = false;
+            g_Terminal.out() << (sort->wasApplied() ? "[Sort finished]\n" : "[Sort discarded: the catalog changed]\n");
+            g_Terminal.flush();
+        } else if (progress >= *reported + 25 && progress < 100) {
+            *reported = progress - progress % 25;
+            g_Terminal.out() << "[Sorting products: " << *reported << "%]\n";
+            g_Terminal.flush();
+        }
+
+        return running;
+    });
+    return true;
+}
+
+// Periodically writes a small key=value metrics snapshot to METRICS_OUTPUT
+// while the UI is idle.
+void startMetricsExport()
+{
+    const char* path = std::getenv("METRICS_OUTPUT");
+    if (!path) {
+        return;
+    }
+
+    std::string metricsPath = path;
+    g_EventLoop.addTimer(std::chrono::milliseconds(1000), [metricsPath]() {
+        const Terminal::Stats& stats = g_Terminal.getStats();
+
+        std::ofstream file(metricsPath, std::ios::trunc);
+        file << "products " << g_ProductManager.getProducts().size() << "\n"
+             << "pending_orders " << g_Orders.size() << "\n"
+             << "cart_size " << g_ShoppingCart.getCartSize() << "\n"
+             << "search_cache_hit_rate " << g_ProductManager.getSearchCacheStats().hitRate() << "\n"
+             << "frames " << stats.frames << "\n"
+             << "write_calls " << stats.writeCalls << "\n"
+             << "bytes_written " << stats.bytes << "\n";
+    });
+}
+
+// Orders beyond the newest LIVE_ORDER_LIMIT are moved into the compressed
+// archive while the UI is idle.
+static const size_t LIVE_ORDER_LIMIT = 10000;
+
+void startOrderArchiving()
+{
+    g_EventLoop.addTimer(std::chrono::milliseconds(5000), []() {
+        g_Orders.archiveOrders(LIVE_ORDER_LIMIT);
+    });
+}
+
+// Concurrent shopping sessions. Each shopper is a C++20 coroutine with its
+// own cart; coroutines are multiplexed on g_TaskScheduler and share
+// g_ProductManager and g_Orders. The catalog is only read while sessions
+// run (product lookups and the locked search cache), and checkout hands a
+// whole cart to Orders under its lock.
+//
+// Sessions speak a line protocol, one reply line per request:
+//
+//   CATALOG                 OK <product count>
+//   SEARCH <text>           OK <match count>
+//   ADD <product id> <qty>  OK | ERR <reason>
+//   REMOVE <product id>     OK | ERR <reason>
+//   CART                    OK <lines> <total cost>
+//   CHECKOUT                OK <orders> <total cost> | ERR empty cart
+//   QUIT                    BYE
+class Session {
+
+    public:
+    Session() {
+    }
+
+    ~Session() {
+        for (Order* order : m_Cart.getCart()) {
+            delete order;
+        }
+        m_Cart.clearCart();
+    }
+
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+    std::string handle(std::string_view line) {
+        TRACE_SCOPE("Session::handle");
+        size_t space = line.find(' ');
+        std::string_view command = line.substr(0, space);
+        std::string_view arguments = space == std::string_view::npos ? std::string_view() : line.substr(space + 1);
+
+        if (command == "CATALOG") {
+            return "OK " + std::to_string(g_ProductManager.getProducts().size());
+        }
+
+        if (command == "SEARCH") {
+            return "OK " + std::to_string(g_ProductManager.getProductsWithString(arguments).size());
+        }
+
+        if (command == "ADD") {
+            int productID = 0;
+            int quantity = 0;
+            if (!parseInts(arguments, {&productID, &quantity})) {
+                return "ERR usage: ADD <product id> <quantity>";
+            }
+
+            Product* product = g_ProductManager.getProduct(productID);
+            if (!product) {
+                return "ERR unknown product";
+            }
+            if (quantity <= 0) {
+                return "ERR invalid quantity";
+            }
+            return m_Cart.addProductToCart(product, quantity) ? "OK" : "ERR insufficient stock";
+        }
+
+        if (command == "REMOVE") {
+            int productID = 0;
+            if (!parseInts(arguments, {&productID})) {
+                return "ERR usage: REMOVE <product id>";
+            }
+            m_Cart.removeProductsFromCart({productID});
+            return "OK";
+        }
+
+        if (command == "CART") {
+            return "OK " + std::to_string(m_Cart.getCartSize()) + " " + std::to_string(m_Cart.getTotalCost());
+        }
+
+        if (command == "CHECKOUT") {
+            if (m_Cart.getCartSize() == 0) {
+                return "ERR empty cart";
+            }
+            int lines = m_Cart.getCartSize();
+            int total = m_Cart.getTotalCost();
+            m_Cart.checkout();
+            return "OK " + std::to_string(lines) + " " + std::to_string(total);
+        }
+
+        if (command == "QUIT") {
+            return "BYE";
+        }
+
+        return "ERR unknown command";
+    }
+
+    private:
+    // Parses exactly values.size() integers separated by single spaces.
+    static bool parseInts(std::string_view text, std::initializer_list<int*> values) {
+        const char* cursor = text.data();
+        const char* end = text.data() + text.size();
+        for (int* value : values) {
+            if (cursor != text.data()) {
+                if (cursor == end || *cursor != ' ') {
+                    return false;
+                }
+                cursor++;
+            }
+            std::from_chars_result result = std::from_chars(cursor, end, *value);
+            if (result.ec != std::errc()) {
+                return false;
+            }
+            cursor = result.ptr;
+        }
+        return cursor == end;
+    }
+
+    ShoppingCart m_Cart;
+};
+
+// Fire-and-forget coroutine. Runs on the calling thread until its first
+// suspension and frees itself when it finishes.
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() {
+            return {};
+        }
+
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+
+        void return_void() {
+        }
+
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+};
+
+// Lazily started coroutine producing a T. Awaiting it runs it and resumes
+// the awaiter (by symmetric transfer) when it returns.
+template <typename T>
+class Task {
+
+    public:
+    struct promise_type {
+        T value;
+        std::coroutine_handle<> continuation;
+
+        Task get_return_object() {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+
+        struct FinalAwaiter {
+            bool await_ready() noexcept {
+                return false;
+            }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                return handle.promise().continuation;
+            }
+
+            void await_resume() noexcept {
+            }
+        };
+
+        FinalAwaiter final_suspend() noexcept {
+            return {};
+        }
+
+        void return_value(T result) {
+            value = std::move(result);
+        }
+
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : m_Handle(handle) {
+    }
+
+    Task(Task&& other) noexcept : m_Handle(std::exchange(other.m_Handle, {})) {
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        if (m_Handle) {
+            m_Handle.destroy();
+        }
+    }
+
+    bool await_ready() {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) {
+        m_Handle.promise().continuation = continuation;
+        return m_Handle;
+    }
+
+    T await_resume() {
+        return std::move(m_Handle.promise().value);
+    }
+
+    private:
+    std::coroutine_handle<promise_type> m_Handle;
+};
+
+#if defined(__linux__)
+
+// Resumes coroutines waiting on socket readiness. Waits are one-shot epoll
+// registrations carrying the waiting coroutine's job; a ready coroutine is
+// submitted to g_TaskScheduler rather than resumed on the reactor thread.
+class SessionReactor {
+
+    public:
+    SessionReactor() {
+        m_Stopping = false;
+        m_Epoll = epoll_create1(EPOLL_CLOEXEC);
+        m_Wakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;
+        epoll_ctl(m_Epoll, EPOLL_CTL_ADD, m_Wakeup, &event);
+
+        m_Thread = std::thread([this]() {
+            run();
+        });
+    }
+
+    ~SessionReactor() {
+        m_Stopping = true;
+        uint64_t one = 1;
+        ssize_t written = ::write(m_Wakeup, &one, sizeof(one));
+        (void)written;
+        m_Thread.join();
+        close(m_Wakeup);
+        close(m_Epoll);
+    }
+
+    auto readable(int fd) {
+        return Awaiter{*this, fd, EPOLLIN};
+    }
+
+    auto writable(int fd) {
+        return Awaiter{*this, fd, EPOLLOUT};
+    }
+
+    private:
+    struct Awaiter : TaskScheduler::Job {
+        SessionReactor& reactor;
+        int fd;
+        uint32_t events;
+        std::coroutine_handle<> handle;
+        // Set once arm() is done with the awaiter; see run().
+        std::atomic<bool> armed { false };
+
+        Awaiter(SessionReactor& owner, int socket, uint32_t waitFor) : reactor(owner), fd(socket), events(waitFor) {
+            execute = [](TaskScheduler::Job* job) {
+                static_cast<Awaiter*>(job)->handle.resume();
+            };
+        }
+
+        bool await_ready() {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> suspended) {
+            handle = suspended;
+            reactor.arm(fd, events, this);
+        }
+
+        void await_resume() {
+        }
+    };
+
+    void arm(int fd, uint32_t events, Awaiter* awaiter) {
+        struct epoll_event event = {};
+        event.events = events | EPOLLONESHOT;
+        event.data.ptr = awaiter;
+        if (epoll_ctl(m_Epoll, EPOLL_CTL_MOD, fd, &event) < 0 && errno == ENOENT) {
+            epoll_ctl(m_Epoll, EPOLL_CTL_ADD, fd, &event);
+        }
+        awaiter->armed.store(true, std::memory_order_release);
+    }
+
+    void run() {
+        struct epoll_event events[64];
+        while (!m_Stopping) {
+            int count = epoll_wait(m_Epoll, events, 64, -1);
+            for (int i = 0; i < count; i++) {
+                Awaiter* awaiter = static_cast<Awaiter*>(events[i].data.ptr);
+                if (!awaiter) {
+                    continue;
+                }
+                // The event can fire before arm() has returned on the
+                // suspending thread. Waiting for the flag orders everything
+                // that thread did, epoll_ctl included, before the resume.
+                while (!awaiter->armed.load(std::memory_order_acquire)) {
+                    std::this_thread::yield();
+                }
+                g_TaskScheduler.submit(*awaiter);
+            }
+        }
+    }
+
+    std::atomic<bool> m_Stopping;
+    int m_Epoll;
+    int m_Wakeup;
+    std::thread m_Thread;
+};
+
+// Splits bytes read from a non-blocking socket into lines.
+class LineReader {
+
+    public:
+    // Returns 1 when bytes were read, 0 on end of stream or error and -1 when
+    // the socket has nothing to read yet.
+    int fill(int fd) {
+        char buffer[4096];
+        ssize_t count = ::read(fd, buffer, sizeof(buffer));
+        if (count > 0) {
+            m_Buffer.append(buffer, (size_t)count);
+            return 1;
+        }
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            return -1;
+        }
+        return 0;
+    }
+
+    bool next(std::string& line) {
+        size_t newline = m_Buffer.find('\n', m_Start);
+        if (newline == std::string::npos) {
+            m_Buffer.erase(0, m_Start);
+            m_Start = 0;
+            return false;
+        }
+
+        line.assign(m_Buffer, m_Start, newline - m_Start);
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        m_Start = newline + 1;
+        return true;
+    }
+
+    private:
+    std::string m_Buffer;
+    size_t m_Start = 0;
+};
+
+Task<bool> readLine(SessionReactor& reactor, int fd, LineReader& reader, std::string& line)
+{
+    while (!reader.next(line)) {
+        int result = reader.fill(fd);
+        if (result == 0) {
+            co_return false;
+        }
+        if (result < 0) {
+            co_await reactor.readable(fd);
+        }
+    }
+    co_return true;
+}
+
+Task<bool> writeAll(SessionReactor& reactor, int fd, std::string data)
+{
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t count = ::send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+        if (count > 0) {
+            written += (size_t)count;
+        } else if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            co_await reactor.writable(fd);
+        } else if (count < 0 && errno != EINTR) {
+            co_return false;
+        }
+    }
+    co_return true;
+}
+
+// Serves sessions on a Unix domain socket, one coroutine per connection.
+class SessionServer {
+
+    public:
+    explicit SessionServer(SessionReactor& reactor) : m_Reactor(reactor) {
+        m_Listener = -1;
+        m_Stopping = false;
+        m_Active = 0;
+        m_Served = 0;
+    }
+
+    ~SessionServer() {
+        stop();
+    }
+
+    bool listen(const std::string& path) {
+        struct sockaddr_un address = {};
+        if (path.size() >= sizeof(address.sun_path)) {
+            return false;
+        }
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+        m_Listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        unlink(path.c_str());
+        if (m_Listener < 0 || bind(m_Listener, (struct sockaddr*)&address, sizeof(address)) < 0 || ::listen(m_Listener, SOMAXCONN) < 0) {
+            if (m_Listener >= 0) {
+                close(m_Listener);
+                m_Listener = -1;
+            }
+            return false;
+        }
+
+        m_Path = path;
+        m_Accepting = std::make_unique<std::latch>(1);
+        accept();
+        return true;
+    }
+
+    // Stops accepting and waits for open sessions to finish.
+    void stop() {
+        if (m_Listener < 0) {
+            return;
+        }
+
+        // The acceptor is parked in epoll; a throwaway connection wakes it so
+        // it can see m_Stopping.
+        m_Stopping = true;
+        int wake = connectSessionSocket(m_Path);
+        m_Accepting->wait();
+        if (wake >= 0) {
+            close(wake);
+        }
+
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_Finished.wait(lock, [this]() {
+            return m_Active == 0;
+        });
+
+        close(m_Listener);
+        unlink(m_Path.c_str());
+        m_Listener = -1;
+    }
+
+    uint64_t getSessionsServed() const {
+        return m_Served.load();
+    }
+
+    // Blocking connect, then switches the socket to non-blocking.
+    static int connectSessionSocket(const std::string& path) {
+        struct sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, path.c_str(), std::min(path.size() + 1, sizeof(address.sun_path) - 1));
+
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        if (connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+            close(fd);
+            return -1;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        return fd;
+    }
+
+    private:
+    DetachedTask accept() {
+        co_await g_TaskScheduler.schedule();
+
+        while (!m_Stopping) {
+            int fd = accept4(m_Listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd >= 0) {
+                {
+                    std::lock_guard<std::mutex> lock(m_Mutex);
+                    m_Active++;
+                }
+                serve(fd);
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                co_await m_Reactor.readable(m_Listener);
+            } else if (errno != EINTR && errno != ECONNABORTED) {
+                break;
+            }
+        }
+        m_Accepting->count_down();
+    }
+
+    DetachedTask serve(int fd) {
+        co_await g_TaskScheduler.schedule();
+
+        {
+            Session session;
+            LineReader reader;
+            std::string line;
+            while (co_await readLine(m_Reactor, fd, reader, line)) {
+                std::string reply = session.handle(line);
+                reply += '\n';
+                if (!co_await writeAll(m_Reactor, fd, std::move(reply)) || line == "QUIT") {
+                    break;
+                }
+            }
+        }
+        close(fd);
+        m_Served.fetch_add(1);
+
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (--m_Active == 0) {
+            m_Finished.notify_all();
+        }
+    }
+
+    SessionReactor& m_Reactor;
+    std::string m_Path;
+    int m_Listener;
+    std::atomic<bool> m_Stopping;
+    std::unique_ptr<std::latch> m_Accepting;
+    std::mutex m_Mutex;
+    std::condition_variable m_Finished;
+    int m_Active;
+    std::atomic<uint64_t> m_Served;
+};
+
+// Client side of the session protocol over a Unix domain socket.
+class SocketSessionChannel {
+
+    public:
+    SocketSessionChannel(SessionReactor& reactor, std::string path) : m_Reactor(&reactor), m_Path(std::move(path)) {
+        m_Fd = -1;
+    }
+
+    bool open() {
+        m_Fd = SessionServer::connectSessionSocket(m_Path);
+        m_Reader = LineReader();
+        return m_Fd >= 0;
+    }
+
+    void close() {
+        ::close(m_Fd);
+        m_Fd = -1;
+    }
+
+    Task<std::string> request(std::string line) {
+        line += '\n';
+        std::string reply;
+        if (!co_await writeAll(*m_Reactor, m_Fd, std::move(line)) || !co_await readLine(*m_Reactor, m_Fd, m_Reader, reply)) {
+            co_return "ERR connection closed";
+        }
+        co_return reply;
+    }
+
+    private:
+    SessionReactor* m_Reactor;
+    std::string m_Path;
+    int m_Fd;
+    LineReader m_Reader;
+};
+
+#endif
+
+// Drives a Session directly. Every request is a hop through the scheduler,
+// standing in for the network round trip.
+class InProcessSessionChannel {
+
+    public:
+
+    bool open() {
+        m_Session = std::make_unique<Session>();
+        return true;
+    }
+
+    void close() {
+        m_Session.reset();
+    }
+
+    Task<std::string> request(std::string line) {
+        co_await g_TaskScheduler.schedule();
+        co_return m_Session->handle(line);
+    }
+
+    private:
+    std::unique_ptr<Session> m_Session;
+};
+
+// Shared by the shoppers of one benchmark run. Every shopper holds a
+// reference, so the latch outlives the last count_down().
+struct SessionLoad {
+    SessionLoad(int sessionCount, int shoppers) : sessions(sessionCount), done(shoppers), latencies(shoppers) {
+    }
+
+    int sessions;
+    std::atomic<int> next { 0 };
+    std::atomic<int> completed { 0 };
+    std::atomic<int> failed { 0 };
+    std::latch done;
+    // Checkout latencies in nanoseconds, one vector per shopper.
+    std::vector<std::vector<uint64_t>> latencies;
+};
+
+// Runs sessions back to back until the load is used up: browse, search
+// twice, fill a cart, check out. Checkout latency is measured from sending
+// CHECKOUT to receiving its reply. Returns the number of sessions run.
+template <typename Channel>
+Task<int> runShopperSessions(Channel channel, SessionLoad& load, std::vector<uint64_t>& checkoutLatencies)
+{
+    static const char* queries[] = {"ba", "an", "Ap", "ple", "go", "ry", "Me", "nut"};
+    const int32_t productCount = (int32_t)g_ProductManager.getProducts().size();
+
+    co_await g_TaskScheduler.schedule();
+
+    int sessionsRun = 0;
+    while (load.next.fetch_add(1) < load.sessions) {
+        if (!channel.open()) {
+            load.failed.fetch_add(1);
+            continue;
+        }
+
+        std::string reply = co_await channel.request("CATALOG");
+        bool ok = reply.starts_with("OK");
+        for (int i = 0; i < 2; i++) {
+            reply = co_await channel.request(std::string("SEARCH ") + queries[Random::Gen(0, 7)]);
+            ok = reply.starts_with("OK") && ok;
+        }
+
+        int lines = Random::Gen(1, 4);
+        for (int i = 0; i < lines; i++) {
+            co_await channel.request("ADD " + std::to_string(Random::Gen(1, productCount)) + " " + std::to_string(Random::Gen(1, 3)));
+        }
+        co_await channel.request("CART");
+
+        auto start = std::chrono::steady_clock::now();
+        reply = co_await channel.request("CHECKOUT");
+        checkoutLatencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+        ok = (reply.starts_with("OK") || reply == "ERR empty cart") && ok;
+
+        reply = co_await channel.request("QUIT");
+        ok = reply == "BYE" && ok;
+        channel.close();
+
+        (ok ? load.completed : load.failed).fetch_add(1);
+        sessionsRun++;
+    }
+
+    co_return sessionsRun;
+}
+
+// One simulated shopper. The sessions' frame, channel included, is gone by
+// the time the latch is counted down, and the shared ownership of the load
+// keeps the latch alive while count_down() returns.
+template <typename Channel>
+DetachedTask runShopper(Channel channel, std::shared_ptr<SessionLoad> load, size_t shopper)
+{
+    co_await runShopperSessions(std::move(channel), *load, load->latencies[shopper]);
+    load->done.count_down();
+}
+
+// Reads one line from stdin as a number. Returns -1 when the line is not a
+// number or input has ended.
+int readInt() {
+    g_Terminal.flush();
+
+    std::string line;
+    if (!g_EventLoop.waitForLine(line)) {
+        return -1;
+    }
+
+    g_Terminal.noteInput(line);
+
+    char* end = nullptr;
+    long value = std::strtol(line.c_str(), &end, 10);
+    if (end == line.c_str()) {
+        return -1;
+    }
+
+    return (int)value;
+}
+
+
+// The interactive catalog shows this many products per page.
+static const size_t CATALOG_PAGE_ROWS = 20;
+size_t g_CatalogFirstRow = 0;
+
+// Prints products [first, first + count), reading them straight out of the
+// ProductManager while formatting; nothing is copied per row.
+void printProductCatalogPage(std::ostream& stream, size_t first, size_t count)
+{
+    std::span<Product* const> products = g_ProductManager.getProducts();
+    first = std::min(first, products.size());
+    count = std::min(count, products.size() - first);
+
+    stream << "Product Catalog (" << products.size();
+    if (count < products.size()) {
+        stream << ", showing " << first + 1 << "-" << first + count;
+    }
+    stream << ")\n";
+
+    Tabulator<int, std::string_view, int, int, std::string_view> tabulator({"ID", "Name", "Price", "Stock Amount", "Description"});
+    tabulator.setColumnFormat({ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::AUTO});
+
+    tabulator.printWindow(stream, [products](size_t i) {
+        Product* product = products[i];
+        return std::make_tuple(product->getID(), product->getName(), product->getPrice(), product->getStockAmount(), product->getDescription());
+    }, products.size(), first, count);
+}
+
+void printProductCatalog(std::ostream& stream)
+{
+    printProductCatalogPage(stream, 0, SIZE_MAX);
+}
+
+void showProductCatalog()
+{
+    std::ostream& out = g_Terminal.beginFrame();
+
+    size_t productCount = g_ProductManager.getProducts().size();
+    bool paged = productCount > CATALOG_PAGE_ROWS;
+    if (g_CatalogFirstRow >= productCount) {
+        g_CatalogFirstRow = 0;
+    }
+
+    printProductCatalogPage(out, g_CatalogFirstRow, paged ? CATALOG_PAGE_ROWS : productCount);
+
+    out << "What would you like to do?\n";
+    out << "1 - Sort Products\n";
+    out << "2 - Add Product to Cart\n";
+    out << "3 - Back\n";
+    if (paged) {
+        out << "4 - Next Page\n";
+        out << "5 - Previous Page\n";
+    }
+
+    int choice = readInt();
+    if (!paged && (choice == 4 || choice == 5)) {
+        choice = -1;
+    }
+
+    switch(choice) {
+        case 1: {
+            out << "Sort by:\n";
+            out << "1 - Price\n";
+            out << "2 - Stock Amount\n";
+            out << "3 - ID\n";
+
+            int sortChoice = readInt();
+
+            out << "Sort order:\n";
+            out << "1 - Ascending\n";
+            out << "2 - Descending\n";
+
+            int sortOrder = readInt();
+
+            SortType sortType;
+            switch(sortChoice) {
+                case 1: {
+                    sortType = SortType::PRICE;
+                    break;
+                }
+                case 2: {
+                    sortType = SortType::STOCK_AMOUNT;
+                    break;
+                }
+                case 3: {
+                    sortType = SortType::ID;
+                    break;
+                }
+                default: {
+                    out << "Invalid sort type\n";
+                    break;
+                }
+            }
+
+            SortOrder order;
+            switch(sortOrder) {
+                case 1: {
+                    order = SortOrder::ASCENDING;
+                    break;
+                }
+                case 2: {
+                    order = SortOrder::DESCENDING;
+                    break;
+                }
+                default: {
+                    out << "Invalid sort order\n";
+                    break;
+                }
+            }
+
+            if (g_ProductManager.getProducts().size() >= ASYNC_SORT_THRESHOLD) {
+                if (startBackgroundSort(sortType, order)) {
+                    out << "Sorting in the background\n";
+                } else {
+                    out << "A background sort is already running\n";
+                }
+            } else {
+                g_ProductManager.sortProducts(sortType, order);
+            }
+            g_CatalogFirstRow = 0;
+            showProductCatalog();
+            break;
+        }
+        case 2: {
+            out << "Enter product id: ";
+
+            int productID = readInt();
+
+            Product* product = g_ProductManager.getProduct(productID);
+            if (!product) {
+                out << "Invalid product id\n";
+                break;
+            }
+
+            again:
+
+            out << "Enter quantity: ";
+            int quantity = readInt();
+
+            if (!g_ShoppingCart.addProductToCart(product, quantity))
+            {
+                out << "Not enough stock\n";
+                goto again;
+                break;
+            }
+
+            out << "Product added to cart\n";
+            break;
+        }
+        case 3: {
+            break;
+        }
+        case 4: {
+            if (g_CatalogFirstRow + CATALOG_PAGE_ROWS < productCount) {
+                g_CatalogFirstRow += CATALOG_PAGE_ROWS;
+            }
+            showProductCatalog();
+            break;
+        }
+        case 5: {
+            g_CatalogFirstRow -= std::min(g_CatalogFirstRow, CATALOG_PAGE_ROWS);
+            showProductCatalog();
+            break;
+        }
+        default: {
+            out << "Invalid choice\n";
+            break;
+        }
+    }
+}
+
+void printShoppingCart(std::ostream& stream, ShoppingCart& cart)
+{
+    stream << "Shopping Cart (" << cart.getCartSize() << ")\n";
+
+    Tabulator<int, std::string_view, int, int, int, int> tabulator({"ID", "Name", "Price", "Quantity", "Product Cost", "Total Cost"});
+    tabulator.setColumnFormat({ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::AUTO});
+    tabulator.reserve(cart.getCart().size());
+
+    for (Order* order : cart.getCart()) {
+        Product* product = g_ProductManager.getProduct(order->getProductID());
+        if (!product) {
+            continue;
+        }
+        tabulator.emplaceRow(product->getID(), product->getName(), product->getPrice(), order->getQuantity(), order->getProductCost(), order->getTotalCost());
+    }
+
+    tabulator.print(stream);
+
+    stream << "Total Product Cost: " << cart.getTotalProductCost() << "\n";
+    stream << "Total Cost: " << cart.getTotalCost() << "\n";
+}
+
+void showShoppingCart()
+{
+    std::ostream& out = g_Terminal.beginFrame();
+
+    printShoppingCart(out, g_ShoppingCart);
+
+    out << "What would you like to do?\n";
+    out << "1 - Checkout\n";
+    out << "2 - Remove Product\n";
+    out << "3 - Back\n";
+
+    int choice = readInt();
+
+    switch(choice) {
+        case 1: {
+            g_ShoppingCart.checkout();
+            out << "Checkout successful\n";
+            break;
+        }
+        case 2: {
+            out << "Enter product id: ";
+            int productID = readInt();
+
+            g_ShoppingCart.removeProductFromCart(productID);
+            out << "Product removed from cart\n";
+            break;
+        }
+        case 3: {
+            break;
+        }
+        default: {
+            out << "Invalid choice\n";
+            break;
+        }
+    }
+}
+
+void printPendingOrders(std::ostream& stream)
+{
+    stream << "Pending Orders (" << g_Orders.size() << ", " << g_Orders.getArchive().size() << " archived)\n";
+
+    Tabulator<int, int, std::string_view, int, int, int, int> tabulator({"Order ID", "Product ID", "Name", "Quantity", "Shipping Cost", "Product Cost", "Total Cost"});
+    tabulator.setColumnFormat({ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::AUTO});
+
+    tabulator.printWindow(stream, [](size_t i) {
+        Order* order = g_Orders.getOrder((int)i);
+        return std::make_tuple(order->getOrderID(), order->getProductID(), order->getProductName(), order->getQuantity(), order->getShippingCost(), order->getProductCost(), order->getTotalCost());
+    }, g_Orders.size());
+}
+
+void showPendingOrders()
+{
+    std::ostream& out = g_Terminal.beginFrame();
+
+    printPendingOrders(out);
+
+    out << "What would you like to do?\n";
+    out << "1 - Remove Order\n";
+    out << "2 - Back\n";
+    out << "3 - Export Catalog and Orders\n";
+
+    int choice = readInt();
+
+    switch(choice) {
+        case 1: {
+            out << "Enter order id: ";
+            int orderID = readInt();
+
+            if (g_Orders.removeOrder(orderID)) {
+                out << "Order removed\n";
+            } else {
+                out << "No pending order with ID " << orderID << "\n";
+            }
+            break;
+        }
+        case 2: {
+            break;
+        }
+        case 3: {
+            bool exported = exportCatalogColumnar("catalog.col", g_ProductManager) &&
+                exportOrdersColumnar("orders.col", g_Orders);
+            out << (exported ? "Exported to catalog.col and orders.col\n" : "Export failed\n");
+            break;
+        }
+        default: {
+            out << "Invalid choice\n";
+            break;
+        }
+    }
+}
+
+bool showMenu() {
+    std::ostream& out = g_Terminal.out();
+
+    out << "What would you like to do?\n";
+    out << "1 - View Product Catalog\n";
+    out << "2 - View Shopping Cart\n";
+    out << "3 - View Pending Orders\n";
+    out << "4 - Exit\n";
+    out << "Enter choice: ";
+
+    int choice = readInt();
+
+    if (g_EventLoop.isInputClosed() && choice < 0) {
+        return false;
+    }
+
+    switch(choice) {
+        case 1: {
+            showProductCatalog();
+            break;
+        }
+        case 2: {
+            showShoppingCart();
+            break;
+        }
+        case 3: {
+            showPendingOrders();
+            break;
+        }
+        case 4: {
+            return false;
+        }
+        default: {
+            out << "Invalid choice\n";
+            break;
+        }
+    }
+
+    return true;
+}
+
+// Builds a deterministic catalog of generated products. Used by the replay
+// driver and the benchmarks so runs are comparable between builds.
+void populateSyntheticCatalog(ProductManager& productManager, int count)
+{
+    static const char* syllables[] = {
+        "ba", "na", "ap", "ple", "or", "an", "ge", "gra", "pe", "pi",
+        "ne", "ki", "wi", "man", "go", "me", "lon", "ber", "ry", "che",
+        "co", "nut", "le", "mo", "li", "me", "fig", "da", "te", "plu"
+    };
+    const uint32_t syllableCount = sizeof(syllables) / sizeof(syllables[0]);
+
+    Random::Xoshiro256 generator((uint64_t)count, 0x5EED);
+
+    auto makeWord = [&](std::string& out) {
+        uint32_t length = 2 + Random::Bounded(generator, 2);
+        for (uint32_t i = 0; i < length; i++) {
+            out += syllables[Random::Bounded(generator, syllableCount)];
+        }
+    };
+
+    for (int i = 0; i < count; i++) {
+        std::string name;
+        makeWord(name);
+        name[0] = (char)std::toupper(name[0]);
+        name += ' ';
+        makeWord(name);
+
+        Product* product = new Product();
+        product->setName(std::move(name));
+        product->setDescription("Generated product " + std::to_string(i));
+        product->setPrice(1 + (int)Random::Bounded(generator, 500));
+        product->setStockAmount((int)Random::Bounded(generator, 1000));
+        productManager.addProduct(product);
+    }
+}
+
+enum class ReplayEventType : uint8_t {
+    CATALOG,
+    BROWSE,
+    VIEW_CART,
+    VIEW_ORDERS,
+    SEARCH,
+    SORT,
+    ADD_TO_CART,
+    REMOVE_FROM_CART,
+    CHECKOUT,
+    REMOVE_ORDER,
+    FUZZY_SEARCH,
+    ADD_BATCH,
+    REMOVE_BATCH,
+    COUNT
+};
+
+static const char* g_ReplayEventNames[] = {
+    "catalog", "browse", "cart", "orders", "search", "sort", "add", "remove", "checkout", "remove-order", "fuzzy", "add-batch",
+    "remove-batch"
+};
+
+// One scripted user action. a/b carry the numeric arguments (product or
+// order ID and quantity, sort type and order, catalog size), text the
+// search query. Order IDs count from 1 for the first order the log places.
+struct ReplayEvent {
+    ReplayEventType type = ReplayEventType::BROWSE;
+    int32_t a = 0;
+    int32_t b = 0;
+    std::string text;
+};
+
+// Event logs come in two flavours:
+//
+//   text    one event per line, '#' starts a comment
+//             catalog <count>          add <count> generated products
+//             browse | cart | orders   render a screen (into memory)
+//             search <query>           getProductsWithString
+//             fuzzy <query>            getProductsFuzzy
+//             add-batch <id>:<qty>,...  addProductsToCart
+//             remove-batch <id>,...    removeProductsFromCart
+//             sort <price|stock|id> <asc|desc>
+//             add <productID> <quantity>
+//             remove <productID>       remove from cart
+//             checkout
+//             remove-order <order id>
+//
+//   binary  the 8 byte magic "CDRPLAY1" followed by records of
+//             u8 type, i32 a, i32 b, u16 text length, text bytes
+//           (host byte order).
+//
+// Both loaders reject a log whose arguments are missing, non-numeric or out
+// of range rather than replaying it with made-up values.
+namespace ReplayLog {
+
+    static const char MAGIC[8] = {'C', 'D', 'R', 'P', 'L', 'A', 'Y', '1'};
+    static const char* SORT_TYPES[] = {"price", "stock", "id"};
+    static const char* SORT_ORDERS[] = {"asc", "desc"};
+
+    inline bool ParseInt(std::string_view token, int32_t& value) {
+        auto [end, result] = std::from_chars(token.data(), token.data() + token.size(), value);
+        return result == std::errc() && end == token.data() + token.size();
+    }
+
+    // Batch lists are "id:quantity,..." for add-batch and "id,..." for
+    // remove-batch.
+    inline bool IsValidBatch(std::string_view text, bool withQuantities) {
+        if (text.empty()) {
+            return true;
+        }
+        for (;;) {
+            size_t comma = text.find(',');
+            std::string_view item = text.substr(0, comma);
+            int32_t value = 0;
+            if (withQuantities) {
+                size_t colon = item.find(':');
+                if (colon == std::string_view::npos || !ParseInt(item.substr(0, colon), value) || !ParseInt(item.substr(colon + 1), value)) {
+                    return false;
+                }
+            } else if (!ParseInt(item, value)) {
+                return false;
+            }
+            if (comma == std::string_view::npos) {
+                break;
+            }
+            text.remove_prefix(comma + 1);
+        }
+        return true;
+    }
+
+    inline bool Validate(const ReplayEvent& event, std::string& error) {
+        switch (event.type) {
+            case ReplayEventType::CATALOG: {
+                if (event.a < 0) {
+                    error = "negative catalog size";
+                    return false;
+                }
+                break;
+            }
+            case ReplayEventType::REMOVE_ORDER: {
+                if (event.a < 1) {
+                    error = "order IDs start at 1";
+                    return false;
+                }
+                break;
+            }
+            case ReplayEventType::SORT: {
+                if (event.a < 0 || event.a > (int32_t)SortType::ID || event.b < 0 || event.b > (int32_t)SortOrder::DESCENDING) {
+                    error = "sort arguments out of range";
+                    return false;
+                }
+                break;
+            }
+            case ReplayEventType::ADD_BATCH:
+            case ReplayEventType::REMOVE_BATCH: {
+                if (!IsValidBatch(event.text, event.type == ReplayEventType::ADD_BATCH)) {
+                    error = "malformed batch '" + event.text + "'";
+                    return false;
+                }
+                break;
+            }
+            default: {
+                break;
+            }
+        }
+        return true;
+    }
+
+    inline bool ParseLine(const std::string& line, ReplayEvent& event, std::string& error) {
+        std::istringstream stream(line);
+        std::string name;
+        if (!(stream >> name) || name[0] == '#') {
+            return false;
+        }
+
+        int type = -1;
+        for (int i = 0; i < (int)ReplayEventType::COUNT; i++) {
+            if (name == g_ReplayEventNames[i]) {
+                type = i;
+            }
+        }
+
+        if (type < 0) {
+            error = "unknown event '" + name + "'";
+            return false;
+        }
+
+        event = ReplayEvent();
+        event.type = (ReplayEventType)type;
+
+        switch (event.type) {
+            case ReplayEventType::SEARCH:
+            case ReplayEventType::FUZZY_SEARCH:
+            case ReplayEventType::ADD_BATCH:
+            case ReplayEventType::REMOVE_BATCH: {
+                std::getline(stream >> std::ws, event.text);
+                break;
+            }
+            case ReplayEventType::SORT: {
+                std::string sortType, sortOrder;
+                stream >> sortType >> sortOrder;
+                auto typeName = std::find(std::begin(SORT_TYPES), std::end(SORT_TYPES), sortType);
+                auto orderName = std::find(std::begin(SORT_ORDERS), std::end(SORT_ORDERS), sortOrder);
+                if (typeName == std::end(SORT_TYPES) || orderName == std::end(SORT_ORDERS)) {
+                    error = "bad sort arguments '" + sortType + " " + sortOrder + "'";
+                    return false;
+                }
+                event.a = (int32_t)(typeName - std::begin(SORT_TYPES));
+                event.b = (int32_t)(orderName - std::begin(SORT_ORDERS));
+                break;
+            }
+            default: {
+                int arguments = event.type == ReplayEventType::ADD_TO_CART ? 2 :
+                    event.type == ReplayEventType::CATALOG || event.type == ReplayEventType::REMOVE_FROM_CART ||
+                    event.type == ReplayEventType::REMOVE_ORDER ? 1 : 0;
+                int32_t* values[] = {&event.a, &event.b};
+                for (int i = 0; i < arguments; i++) {
+                    std::string token;
+                    if (!(stream >> token) || !ParseInt(token, *values[i])) {
+                        error = "expected a number for '" + name + "'" + (token.empty() ? "" : ", got '" + token + "'");
+                        return false;
+                    }
+                }
+                break;
+            }
+        }
+
+        std::string extra;
+        if (event.type != ReplayEventType::SEARCH && event.type != ReplayEventType::FUZZY_SEARCH && stream >> extra) {
+            error = "unexpected argument '" + extra + "'";
+            return false;
+        }
+
+        return Validate(event, error);
+    }
+
+    inline bool Load(const char* path, std::vector<ReplayEvent>& events, std::string& error) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            error = std::string("cannot open ") + path;
+            return false;
+        }
+
+        char magic[sizeof(MAGIC)] = {};
+        file.read(magic, sizeof(magic));
+
+        if (file.gcount() == sizeof(MAGIC) && std::equal(magic, magic + sizeof(MAGIC), MAGIC)) {
+            for (;;) {
+                uint8_t type;
+                uint16_t length;
+                ReplayEvent event;
+
+                if (!file.read((char*)&type, sizeof(type))) {
+                    break;
+                }
+                file.read((char*)&event.a, sizeof(event.a));
+                file.read((char*)&event.b, sizeof(event.b));
+                file.read((char*)&length, sizeof(length));
+                event.text.resize(length);
+                file.read(&event.text[0], length);
+
+                if (!file || type >= (uint8_t)ReplayEventType::COUNT) {
+                    error = "truncated or corrupt binary log";
+                    return false;
+                }
+
+                event.type = (ReplayEventType)type;
+                if (!Validate(event, error)) {
+                    error = "record " + std::to_string(events.size() + 1) + ": " + error;
+                    return false;
+                }
+                events.push_back(std::move(event));
+            }
+            return true;
+        }
+
+        file.clear();
+        file.seekg(0);
+
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(file, line)) {
+            lineNumber++;
+
+            ReplayEvent event;
+            if (ReplayLog::ParseLine(line, event, error)) {
+                events.push_back(std::move(event));
+            } else if (!error.empty()) {
+                error = "line " + std::to_string(lineNumber) + ": " + error;
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    inline bool SaveBinary(const char* path, const std::vector<ReplayEvent>& events) {
+        std::ofstream file(path, std::ios::binary);
+        file.write(MAGIC, sizeof(MAGIC));
+
+        for (const ReplayEvent& event : events) {
+            uint8_t type = (uint8_t)event.type;
+            uint16_t length = (uint16_t)std::min<size_t>(event.text.size(), UINT16_MAX);
+            file.write((const char*)&type, sizeof(type));
+            file.write((const char*)&event.a, sizeof(event.a));
+            file.write((const char*)&event.b, sizeof(event.b));
+            file.write((const char*)&length, sizeof(length));
+            file.write(event.text.data(), length);
+        }
+
+        return (bool)file;
+    }
+
+    inline bool SaveText(const char* path, const std::vector<ReplayEvent>& events) {
+        std::ofstream file(path);
+        std::string error;
+
+        for (const ReplayEvent& event : events) {
+            if (!Validate(event, error)) {
+                return false;
+            }
+            file << g_ReplayEventNames[(int)event.type];
+
+            switch (event.type) {
+                case ReplayEventType::CATALOG:
+                case ReplayEventType::REMOVE_FROM_CART:
+                case ReplayEventType::REMOVE_ORDER: {
+                    file << ' ' << event.a;
+                    break;
+                }
+                case ReplayEventType::ADD_TO_CART: {
+                    file << ' ' << event.a << ' ' << event.b;
+                    break;
+                }
+                case ReplayEventType::SEARCH:
+                case ReplayEventType::FUZZY_SEARCH:
+                case ReplayEventType::ADD_BATCH:
+                case ReplayEventType::REMOVE_BATCH: {
+                    file << ' ' << event.text;
+                    break;
+                }
+                case ReplayEventType::SORT: {
+                    file << ' ' << SORT_TYPES[event.a] << ' ' << SORT_ORDERS[event.b];
+                    break;
+                }
+                default: {
+                    break;
+                }
+            }
+
+            file << '\n';
+        }
+
+        return (bool)file;
+    }
+
+    // A synthetic shopping session mix over a generated catalog.
+    inline std::vector<ReplayEvent> Generate(size_t count, int catalogSize, uint64_t seed) {
+        static const char* queries[] = {"ba", "Ap", "na", "or", "gra", "pi", "me", "lon", "ber", "Che", "co", "ki", "wi", "mo"};
+        const uint32_t queryCount = sizeof(queries) / sizeof(queries[0]);
+
+        Random::Xoshiro256 generator(seed, 0);
+        std::vector<ReplayEvent> events;
+        events.reserve(count + 1);
+
+        ReplayEvent catalog;
+        catalog.type = ReplayEventType::CATALOG;
+        catalog.a = catalogSize;
+        events.push_back(catalog);
+
+        int placedOrders = 0;
+        int cartSize = 0;
+
+        for (size_t i = 0; i < count; i++) {
+            ReplayEvent event;
+            uint32_t roll = Random::Bounded(generator, 100);
+
+            if (roll < 5) {
+                event.type = ReplayEventType::BROWSE;
+            } else if (roll < 35) {
+                event.type = ReplayEventType::SEARCH;
+                event.text = queries[Random::Bounded(generator, queryCount)];
+            } else if (roll < 40) {
+                event.type = ReplayEventType::SORT;
+                event.a = (int32_t)Random::Bounded(generator, 3);
+                event.b = (int32_t)Random::Bounded(generator, 2);
+            } else if (roll < 75) {
+                event.type = ReplayEventType::ADD_TO_CART;
+                event.a = 1 + (int32_t)Random::Bounded(generator, catalogSize + 5);
+                event.b = 1 + (int32_t)Random::Bounded(generator, 5);
+                cartSize++;
+            } else if (roll < 80) {
+                event.type = ReplayEventType::REMOVE_FROM_CART;
+                event.a = 1 + (int32_t)Random::Bounded(generator, catalogSize + 5);
+            } else if (roll < 85) {
+                event.type = ReplayEventType::VIEW_CART;
+            } else if (roll < 95) {
+                event.type = ReplayEventType::CHECKOUT;
+                placedOrders += cartSize;
+                cartSize = 0;
+            } else if (roll < 97) {
+                event.type = ReplayEventType::VIEW_ORDERS;
+            } else {
+                // Any order placed so far; some were already removed or never
+                // placed because their add failed, and replay skips those.
+                event.type = ReplayEventType::REMOVE_ORDER;
+                event.a = 1 + (int32_t)Random::Bounded(generator, std::max(placedOrders, 1));
+            }
+
+            events.push_back(std::move(event));
+        }
+
+        return events;
+    }
+}
+
+// Runs an event log against the store classes with no terminal I/O. Screens
+// are rendered into an in-memory stream so their cost is still measured.
+class ReplayDriver {
+
+    public:
+    explicit ReplayDriver(ShoppingCart& cart) : m_Cart(cart) {
+        m_OrderIDBase = g_Orders.getLastOrderID();
+        m_Checksum = 0;
+        m_Seconds = 0;
+        m_EventCount = 0;
+    }
+
+    void apply(const ReplayEvent& event) {
+        switch (event.type) {
+            case ReplayEventType::CATALOG: {
+                populateSyntheticCatalog(g_ProductManager, event.a);
+                break;
+            }
+            case ReplayEventType::BROWSE: {
+                render(printProductCatalog);
+                break;
+            }
+            case ReplayEventType::VIEW_CART: {
+                m_Sink.str("");
+                printShoppingCart(m_Sink, m_Cart);
+                m_Checksum += (uint64_t)m_Sink.tellp();
+                break;
+            }
+            case ReplayEventType::VIEW_ORDERS: {
+                render(printPendingOrders);
+                break;
+            }
+            case ReplayEventType::SEARCH: {
+                m_Checksum += g_ProductManager.getProductsWithString(event.text.c_str()).size();
+                break;
+            }
+            case ReplayEventType::FUZZY_SEARCH: {
+                m_Checksum += g_ProductManager.getProductsFuzzy(event.text.c_str()).size();
+                break;
+            }
+            case ReplayEventType::ADD_BATCH: {
+                std::vector<CartLine> lines;
+                const char* cursor = event.text.c_str();
+                char* end = nullptr;
+                for (;;) {
+                    CartLine line;
+                    line.productID = (int)std::strtol(cursor, &end, 10);
+                    if (end == cursor || *end != ':') {
+                        break;
+                    }
+                    cursor = end + 1;
+                    line.quantity = (int)std::strtol(cursor, &end, 10);
+                    lines.push_back(line);
+                    if (*end != ',') {
+                        break;
+                    }
+                    cursor = end + 1;
+                }
+
+                for (const CartLineResult& result : m_Cart.addProductsToCart(lines)) {
+                    m_Checksum += (uint64_t)result.status;
+                }
+                break;
+            }
+            case ReplayEventType::REMOVE_BATCH: {
+                std::vector<int> productIDs;
+                const char* cursor = event.text.c_str();
+                char* end = nullptr;
+                for (;;) {
+                    int productID = (int)std::strtol(cursor, &end, 10);
+                    if (end == cursor) {
+                        break;
+                    }
+                    productIDs.push_back(productID);
+                    if (*end != ',') {
+                        break;
+                    }
+                    cursor = end + 1;
+                }
+
+                m_Checksum += m_Cart.removeProductsFromCart(std::move(productIDs));
+                break;
+            }
+            case ReplayEventType::SORT: {
+                g_ProductManager.sortProducts((SortType)event.a, (SortOrder)event.b);
+                break;
+            }
+            case ReplayEventType::ADD_TO_CART: {
+                Product* product = g_ProductManager.getProduct(event.a);
+                if (product && m_Cart.addProductToCart(product, event.b)) {
+                    m_Checksum += (uint64_t)event.a;
+                }
+                break;
+            }
+            case ReplayEventType::REMOVE_FROM_CART: {
+                m_Cart.removeProductFromCart(event.a);
+                break;
+            }
+            case ReplayEventType::CHECKOUT: {
+                m_Checksum += (uint64_t)m_Cart.getTotalCost();
+                m_Cart.checkout();
+                break;
+            }
+            case ReplayEventType::REMOVE_ORDER: {
+                if (g_Orders.removeOrder(m_OrderIDBase + event.a)) {
+                    m_Checksum += (uint64_t)event.a;
+                }
+                break;
+            }
+            default: {
+                break;
+            }
+        }
+    }
+
+    void run(const std::vector<ReplayEvent>& events) {
+        auto runStart = std::chrono::steady_clock::now();
+
+        for (const ReplayEvent& event : events) {
+            auto start = std::chrono::steady_clock::now();
+            apply(event);
+            auto end = std::chrono::steady_clock::now();
+
+            m_Latencies[(size_t)event.type].push_back(
+                (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        }
+
+        m_Seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count();
+        m_EventCount += events.size();
+    }
+
+    void printReport(std::ostream& stream) {
+        stream << "Replayed " << m_EventCount << " events in " << std::fixed << std::setprecision(3) << m_Seconds << " s ("
+               << (uint64_t)(m_EventCount / std::max(m_Seconds, 1e-9)) << " events/sec), checksum " << m_Checksum << "\n";
+
+        Tabulator<std::string, int, double, double, double, double> tabulator({"Event", "Count", "p50 us", "p90 us", "p99 us", "Max us"}, 10);
+        tabulator.setColumnFormat({ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::FIXED, ColumnFormat::FIXED, ColumnFormat::FIXED, ColumnFormat::FIXED});
+        tabulator.setColumnPrecision({0, 0, 2, 2, 2, 2});
+
+        for (size_t i = 0; i < (size_t)ReplayEventType::COUNT; i++) {
+            std::vector<uint64_t>& latencies = m_Latencies[i];
+            if (latencies.empty()) {
+                continue;
+            }
+
+            std::sort(latencies.begin(), latencies.end());
+            auto percentile = [&](double p) {
+                return latencies[std::min(latencies.size() - 1, (size_t)(p * latencies.size()))] / 1000.0;
+            };
+
+            tabulator.addRow(g_ReplayEventNames[i], (int)latencies.size(), percentile(0.5), percentile(0.9), percentile(0.99), latencies.back() / 1000.0);
+        }
+
+        tabulator.print(stream);
+        stream.unsetf(std::ios_base::floatfield);
+    }
+
+    uint64_t getChecksum() {
+        return m_Checksum;
+    }
+
+    private:
+    void render(void (*screen)(std::ostream&)) {
+        m_Sink.str("");
+        screen(m_Sink);
+        m_Checksum += (uint64_t)m_Sink.tellp();
+    }
+
+    ShoppingCart& m_Cart;
+    // Log order ID n is the n-th order placed after the driver was created.
+    int m_OrderIDBase;
+    std::ostringstream m_Sink;
+    std::vector<uint64_t> m_Latencies[(size_t)ReplayEventType::COUNT];
+    uint64_t m_Checksum;
+    double m_Seconds;
+    size_t m_EventCount;
+};
+
+int runReplay(const char* path, uint64_t seed)
+{
+    std::vector<ReplayEvent> events;
+    std::string error;
+    if (!ReplayLog::Load(path, events, error)) {
+        std::cout << "Failed to load replay log: " << error << "\n";
+        return 1;
+    }
+
+    Random::SetSeed(seed);
+    Random::SetThreadStream(0);
+
+    ReplayDriver driver(g_ShoppingCart);
+    driver.run(events);
+    driver.printReport(std::cout);
+    return 0;
+}
+
+// Stdio-style buffered stream over a file descriptor that counts the write
+// calls it makes, so the old std::endl output path can be compared with
+// frame rendering.
+class CountingFdStreamBuf : public std::streambuf {
+
+    public:
+    explicit CountingFdStreamBuf(int fd) : m_Buffer(BUFSIZ) {
+        m_Fd = fd;
+        m_WriteCalls = 0;
+        setp(m_Buffer.data(), m_Buffer.data() + m_Buffer.size());
+    }
+
+    uint64_t getWriteCalls() const {
+        return m_WriteCalls;
+    }
+
+    protected:
+    int_type overflow(int_type ch) override {
+        sync();
+        if (ch != traits_type::eof()) {
+            *pptr() = (char)ch;
+            pbump(1);
+        }
+        return ch;
+    }
+
+    int sync() override {
+        if (pptr() > pbase()) {
+            writeToFd(m_Fd, pbase(), (size_t)(pptr() - pbase()), m_WriteCalls);
+            setp(m_Buffer.data(), m_Buffer.data() + m_Buffer.size());
+        }
+        return 0;
+    }
+
+    private:
+    std::vector<char> m_Buffer;
+    int m_Fd;
+    uint64_t m_WriteCalls;
+};
+
+int openNullDevice()
+{
+#ifdef _WIN32
+    return _open("NUL", _O_WRONLY);
+#else
+    return open("/dev/null", O_WRONLY);
+#endif
+}
+
+// Timing and result formatting shared by the --bench-* modes.
+namespace Benchmark {
+
+    // Wall-clock seconds taken by one call of fn.
+    template <typename Fn>
+    double Seconds(Fn&& fn) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // One line of results on std::cout. Numbers are written in fixed
+    // notation at the given precision (change it mid-line with
+    // std::setprecision); the stream's previous format is restored once the
+    // line goes out of scope, e.g.
+    //
+    //   Benchmark::Line(3).label("render", 12) << seconds * 1000.0 << " ms\n";
+    class Line {
+
+        public:
+        explicit Line(int precision) : m_Flags(std::cout.flags()), m_Precision(std::cout.precision()) {
+            std::cout << std::fixed << std::setprecision(precision);
+        }
+
+        ~Line() {
+            std::cout.flags(m_Flags);
+            std::cout.precision(m_Precision);
+        }
+
+        Line(const Line&) = delete;
+        Line& operator=(const Line&) = delete;
+
+        // Writes name left-aligned in a column of the given width.
+        Line& label(std::string_view name, int width) {
+            std::cout << std::left << std::setw(width) << name << std::right;
+            return *this;
+        }
+
+        template <typename T>
+        Line& operator<<(const T& value) {
+            std::cout << value;
+            return *this;
+        }
+
+        private:
+        std::ios_base::fmtflags m_Flags;
+        std::streamsize m_Precision;
+    };
+
+    struct FrameCost {
+        double seconds;
+        uint64_t allocations;
+        uint64_t bytes;
+    };
+
+    // Renders frames screens through the terminal after one untimed frame,
+    // which sizes the reusable frame buffer. Allocations are only counted
+    // in COUNT_ALLOCATIONS builds.
+    template <typename Render>
+    FrameCost MeasureFrames(Terminal& terminal, int frames, Render&& render) {
+        render(terminal.beginFrame());
+        terminal.flush();
+
+        uint64_t allocations = AllocationCounter::Count();
+        uint64_t bytes = AllocationCounter::Bytes();
+        double seconds = Seconds([&]() {
+            for (int frame = 0; frame < frames; frame++) {
+                render(terminal.beginFrame());
+                terminal.flush();
+            }
+        });
+        return {seconds, AllocationCounter::Count() - allocations, AllocationCounter::Bytes() - bytes};
+    }
+}
+
+void runRenderBenchmark(int catalogSize, int frames)
+{
+    populateSyntheticCatalog(g_ProductManager, catalogSize);
+    int fd = openNullDevice();
+
+    auto report = [frames](const char* name, double seconds, uint64_t writeCalls) {
+        Benchmark::Line(3).label(name, 34) << seconds * 1000.0 / frames << " ms/frame, " << std::setprecision(1)
+            << (double)writeCalls / frames << " write calls/frame\n";
+    };
+
+    {
+        CountingFdStreamBuf buffer(fd);
+        std::ostream stream(&buffer);
+
+        double seconds = Benchmark::Seconds([&]() {
+            for (int frame = 0; frame < frames; frame++) {
+                for (Product* product : g_ProductManager.getProducts()) {
+                    stream << "Product ID: " << product->getID() << std::endl;
+                    stream << "Product Name: " << product->getName() << std::endl;
+                    stream << "Product Price: " << product->getPrice() << std::endl;
+                    stream << "Product Stock Amount: " << product->getStockAmount() << std::endl;
+                    stream << "Product Description: " << product->getDescription() << std::endl;
+                    stream << std::endl;
+                }
+            }
+        });
+        report("printProducts with std::endl", seconds, buffer.getWriteCalls());
+    }
+
+    {
+        Terminal terminal;
+        terminal.setOutput(fd);
+
+        double seconds = Benchmark::Seconds([&]() {
+            for (int frame = 0; frame < frames; frame++) {
+                g_ProductManager.printProducts(terminal.beginFrame());
+                terminal.flush();
+            }
+        });
+        report("printProducts into a frame", seconds, terminal.getStats().writeCalls);
+    }
+
+    {
+        CountingFdStreamBuf buffer(fd);
+        std::ostream stream(&buffer);
+
+        double seconds = Benchmark::Seconds([&]() {
+            for (int frame = 0; frame < frames; frame++) {
+                printProductCatalog(stream);
+                stream.flush();
+            }
+        });
+        report("catalog screen, stdio buffered", seconds, buffer.getWriteCalls());
+    }
+
+    for (int diff = 0; diff < 2; diff++) {
+        Terminal terminal;
+        terminal.setOutput(fd);
+        terminal.setTerminalRows(catalogSize + 16);
+        terminal.setDiffEnabled(diff != 0);
+
+        Product* product = g_ProductManager.getProducts().front();
+        double seconds = Benchmark::Seconds([&]() {
+            for (int frame = 0; frame < frames; frame++) {
+                product->setStockAmount(frame % 1000);
+                printProductCatalog(terminal.beginFrame());
+                terminal.flush();
+            }
+        });
+        report(diff ? "catalog screen, diffed frame" : "catalog screen, full frame", seconds, terminal.getStats().writeCalls);
+        std::cout << "    " << terminal.getStats().bytes / frames << " bytes/frame, "
+                  << terminal.getStats().linesRedrawn / frames << " lines redrawn/frame\n";
+    }
+}
+
+// Counts heap allocations per rendered screen. Needs -DCOUNT_ALLOCATIONS=1.
+void runAllocationBenchmark(int catalogSize, int frames)
+{
+    if (!AllocationCounter::Enabled()) {
+        std::cout << "Build with -DCOUNT_ALLOCATIONS=1 to count allocations\n";
+        return;
+    }
+
+    populateSyntheticCatalog(g_ProductManager, catalogSize);
+    Random::SetSeed(8);
+    for (int i = 0; i < catalogSize; i++) {
+        Order* order = new Order();
+        order->setCheckedOut(true);
+        order->setProductID(Random::Gen(1, catalogSize));
+        order->setQuantity(Random::Gen(1, 5));
+        order->setShippingCost(Random::Gen(10, 100));
+        g_Orders.addOrder(order);
+    }
+
+    Terminal terminal;
+    terminal.setOutput(openNullDevice());
+
+    auto measure = [&](const char* name, auto&& render) {
+        Benchmark::FrameCost cost = Benchmark::MeasureFrames(terminal, frames, render);
+        Benchmark::Line(2).label(name, 16) << ": " << cost.allocations / frames << " allocations/frame ("
+            << (double)cost.allocations / frames / catalogSize << " per row), " << cost.bytes / frames << " bytes/frame, "
+            << std::setprecision(3) << cost.seconds * 1000.0 / frames << " ms/frame\n";
+    };
+
+    measure("catalog screen", [](std::ostream& out) { printProductCatalog(out); });
+    measure("orders screen", [](std::ostream& out) { printPendingOrders(out); });
+    measure("product list", [](std::ostream& out) { g_ProductManager.printProducts(out); });
+}
+
+// Compares rendering the whole catalog with rendering one scrolled page of
+// it as the catalog grows; the page should cost the same at every size.
+void runWindowBenchmark(int maxCatalogSize, int frames)
+{
+    Terminal terminal;
+    terminal.setOutput(openNullDevice());
+
+    auto measure = [&](const char* name, int catalogSize, auto&& render) {
+        Benchmark::FrameCost cost = Benchmark::MeasureFrames(terminal, frames, render);
+        Benchmark::Line line(3);
+        line.label(name, 14) << std::setw(9) << catalogSize << " products: " << cost.seconds * 1000.0 / frames << " ms/frame";
+        if (AllocationCounter::Enabled()) {
+            line << ", " << cost.allocations / frames << " allocations/frame, " << cost.bytes / frames << " bytes/frame";
+        }
+        line << "\n";
+    };
+
+    for (int catalogSize = 10000; catalogSize <= maxCatalogSize; catalogSize *= 10) {
+        populateSyntheticCatalog(g_ProductManager, catalogSize - (int)g_ProductManager.getProducts().size());
+
+        measure("full catalog", catalogSize, [](std::ostream& out) { printProductCatalog(out); });
+        measure("catalog page", catalogSize, [catalogSize](std::ostream& out) {
+            printProductCatalogPage(out, catalogSize / 2, CATALOG_PAGE_ROWS);
+        });
+    }
+}
+
+void runSearchCacheBenchmark(int catalogSize, int queryCount)
+{
+    populateSyntheticCatalog(g_ProductManager, catalogSize);
+    Random::SetSeed(7);
+
+    // Distinct queries are name prefixes and inner substrings of random
+    // products; traffic over them follows a Zipf(1.0) distribution.
+    const size_t distinctQueries = 2000;
+    std::vector<std::string> queries;
+    std::span<Product* const> products = g_ProductManager.getProducts();
+    while (queries.size() < distinctQueries) {
+        std::string name(products[Random::Gen(0, (int32_t)products.size() - 1)]->getName());
+        size_t start = Random::Gen(0, 1) ? 0 : (size_t)Random::Gen(0, (int32_t)name.size() - 3);
+        size_t length = (size_t)Random::Gen(2, 6);
+        queries.push_back(name.substr(start, length));
+    }
+
+    std::vector<double> cdf(distinctQueries);
+    double total = 0;
+    for (size_t i = 0; i < distinctQueries; i++) {
+        total += 1.0 / (double)(i + 1);
+        cdf[i] = total;
+    }
+
+    std::vector<uint32_t> mix(queryCount);
+    for (uint32_t& query : mix) {
+        double roll = Random::GenDouble() * total;
+        query = (uint32_t)(std::lower_bound(cdf.begin(), cdf.end(), roll) - cdf.begin());
+        query = std::min<uint32_t>(query, (uint32_t)distinctQueries - 1);
+    }
+
+    // One rename per renameInterval queries keeps invalidation in the picture.
+    const int renameInterval = 5000;
+
+    for (int cached = 0; cached < 2; cached++) {
+        g_ProductManager.setSearchCacheEnabled(cached != 0);
+        g_ProductManager.resetSearchCacheStats();
+
+        uint64_t results = 0;
+        double seconds = Benchmark::Seconds([&]() {
+            for (int i = 0; i < queryCount; i++) {
+                if (i % renameInterval == renameInterval - 1) {
+                    Product* product = products[(size_t)i % products.size()];
+                    product->setName(std::string(product->getName()));
+                }
+
+                const std::string& query = queries[mix[i]];
+                if (i % 4 == 0) {
+                    results += g_ProductManager.getProductByName(query.c_str()) != nullptr;
+                } else {
+                    results += g_ProductManager.getProductsWithString(query.c_str()).size();
+                }
+            }
+        });
+
+        SearchCache::Stats stats = g_ProductManager.getSearchCacheStats();
+        Benchmark::Line line(1);
+        line.label(cached ? "cached" : "uncached", 8) << ": " << (uint64_t)(queryCount / seconds) << " queries/sec, "
+            << results << " results";
+        if (cached) {
+            line << ", hit rate " << stats.hitRate() * 100.0 << "% (" << stats.hits << " hits, " << stats.misses
+                << " misses, " << stats.stale << " stale, " << stats.evictions << " evictions)";
+        }
+        line << "\n";
+    }
+
+    g_ProductManager.setSearchCacheEnabled(true);
+}
+
+void runFuzzyBenchmark(int catalogSize, int queryCount)
+{
+    populateSyntheticCatalog(g_ProductManager, catalogSize);
+    Random::SetSeed(11);
+
+    // Queries are product names or single words with one or two random
+    // typos (substitution, insertion or deletion).
+    std::span<Product* const> products = g_ProductManager.getProducts();
+    std::vector<std::string> queries;
+    std::vector<int> expected;
+    for (int i = 0; i < queryCount; i++) {
+        Product* product = products[Random::Gen(0, (int32_t)products.size() - 1)];
+        std::string query(product->getName());
+        if (Random::Gen(50.0)) {
+            query = query.substr(0, query.find(' '));
+        }
+
+        int typos = Random::Gen(1, 2);
+        for (int typo = 0; typo < typos && query.size() > 2; typo++) {
+            size_t position = (size_t)Random::Gen(0, (int32_t)query.size() - 1);
+            switch (Random::Gen(0, 2)) {
+                case 0: query[position] = (char)('a' + Random::Gen(0, 25)); break;
+                case 1: query.insert(position, 1, (char)('a' + Random::Gen(0, 25))); break;
+                default: query.erase(position, 1); break;
+            }
+        }
 
+        queries.push_back(query);
+        expected.push_back(product->getID());
+    }
 
-void showProductCatalog()
+    double buildSeconds = Benchmark::Seconds([]() {
+        g_ProductManager.getProductsFuzzy("");
+    });
+
+    int found = 0;
+    size_t results = 0;
+    double seconds = Benchmark::Seconds([&]() {
+        for (int i = 0; i < queryCount; i++) {
+            std::vector<Product*> matches = g_ProductManager.getProductsFuzzy(queries[i].c_str(), 2, 1000);
+            results += matches.size();
+            for (Product* match : matches) {
+                if (match->getID() == expected[i]) {
+                    found++;
+                    break;
+                }
+            }
+        }
+    });
+
+    Benchmark::Line(1) << "Fuzzy index over " << catalogSize << " products built in " << buildSeconds * 1000.0 << " ms\n"
+        << queryCount << " queries (max distance 2): " << std::setprecision(3) << seconds * 1000.0 / queryCount
+        << " ms/query, " << results / std::max(queryCount, 1) << " results/query, target found in "
+        << std::setprecision(1) << 100.0 * found / std::max(queryCount, 1) << "%\n";
+}
+
+void runShardedBenchmark(int catalogSize, int operationCount)
 {
-    clear();
+    const size_t shardCounts[] = {1, 2, 4, 8, 16, 32};
+    const unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    const size_t window = 64;
 
-    std::cout << "Product Catalog (" << g_ProductManager.getProducts().size() << ")\n";
+    for (size_t shardCount : shardCounts) {
+        // A client per shard at least, so the shards rather than the clients
+        // are what gets saturated; never fewer clients than cores.
+        const unsigned int clientCount = std::max((unsigned int)shardCount, cores);
 
-    Tabulator<int, std::string, int, int, std::string> tabulator({"ID", "Name", "Price", "Stock Amount", "Description"});
-    tabulator.setColumnFormat({ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::AUTO});
+        ShardedProductManager catalog(shardCount);
+        {
+            ProductManager generated;
+            populateSyntheticCatalog(generated, catalogSize);
+            std::vector<std::future<int>> added;
+            for (Product* product : generated.getProducts()) {
+                Product* copy = new Product(*product);
+                copy->setCatalogGeneration(nullptr);
+                added.push_back(catalog.addProduct(copy));
+            }
+            for (auto& ID : added) {
+                ID.get();
+            }
+        }
 
-    for (Product* product : g_ProductManager.getProducts()) {
-        tabulator.addRow(product->getID(), product->getName(), product->getPrice(), product->getStockAmount(), product->getDescription());        
-    }
+        // 90% lookups, 8% stock updates, 1% inserts, 1% scatter-gather
+        // searches or sorted listings, issued in pipelined windows.
+        std::atomic<uint64_t> completed { 0 };
+        std::vector<std::thread> clients;
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned int client = 0; client < clientCount; client++) {
+            clients.emplace_back([&, client]() {
+                Random::SetThreadStream(client);
+                int operations = operationCount / (int)clientCount;
+                std::vector<std::future<bool>> pending;
+
+                for (int i = 0; i < operations; i++) {
+                    int roll = Random::Gen(0, 99);
+                    int ID = Random::Gen(1, catalogSize);
+
+                    if (roll < 90) {
+                        pending.push_back(catalog.submit(catalog.shardOf(ID), [ID](ProductManager& products) {
+                            return products.getProduct(ID) != nullptr;
+                        }));
+                    } else if (roll < 98) {
+                        pending.push_back(catalog.setStockAmount(ID, Random::Gen(0, 1000)));
+                    } else if (roll < 99) {
+                        Product* product = new Product();
+                        product->setName("Bench product");
+                        catalog.addProduct(product).get();
+                    } else if (i % 2) {
+                        catalog.searchProducts("Ban");
+                    } else {
+                        catalog.getSortedProductIDs(SortType::PRICE, SortOrder::ASCENDING, 20);
+                    }
 
-    tabulator.print(std::cout);
+                    if (pending.size() >= window) {
+                        for (auto& result : pending) {
+                            result.get();
+                        }
+                        pending.clear();
+                    }
+                }
 
-    std::cout << "What would you like to do?\n";
-    std::cout << "1 - Sort Products\n";
-    std::cout << "2 - Add Product to Cart\n";
-    std::cout << "3 - Back\n";
+                for (auto& result : pending) {
+                    result.get();
+                }
+                completed += (uint64_t)operations;
+            });
+        }
+        for (auto& client : clients) {
+            client.join();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-    int choice;
-    std::cin >> choice;
+        std::cout << "shards=" << std::setw(2) << shardCount << " clients=" << std::setw(2) << clientCount << " cores=" << cores << ": "
+                  << (uint64_t)(completed / seconds) << " ops/sec over " << catalog.size() << " products\n";
+    }
+}
 
-    switch(choice) {
-        case 1: {
-            std::cout << "Sort by:\n";
-            std::cout << "1 - Price\n";
-            std::cout << "2 - Stock Amount\n";
-            std::cout << "3 - ID\n";
+void runCartBatchBenchmark(int lineCount)
+{
+    populateSyntheticCatalog(g_ProductManager, 100000);
+    Random::SetSeed(3);
 
-            int sortChoice;
-            std::cin >> sortChoice;
+    std::vector<CartLine> lines(lineCount);
+    for (CartLine& line : lines) {
+        line.productID = Random::Gen(1, 100500);
+        line.quantity = Random::Gen(1, 50);
+    }
 
-            std::cout << "Sort order:\n";
-            std::cout << "1 - Ascending\n";
-            std::cout << "2 - Descending\n";
+    std::vector<int> removals;
+    for (int i = 0; i < lineCount / 2; i++) {
+        removals.push_back(lines[(size_t)Random::Gen(0, lineCount - 1)].productID);
+    }
 
-            int sortOrder;
-            std::cin >> sortOrder;
+    for (int batched = 0; batched < 2; batched++) {
+        ShoppingCart cart;
+        size_t added = 0;
 
-            SortType sortType;
-            switch(sortChoice) {
-                case 1: {
-                    sortType = SortType::PRICE;
-                    break;
-                }
-                case 2: {
-                    sortType = SortType::STOCK_AMOUNT;
-                    break;
-                }
-                case 3: {
-                    sortType = SortType::ID;
-                    break;
-                }
-                default: {
-                    std::cout << "Invalid sort type\n";
-                    break;
-                }
+        auto start = std::chrono::steady_clock::now();
+        if (batched) {
+            for (const CartLineResult& result : cart.addProductsToCart(lines)) {
+                added += result.status == CartLineStatus::OK;
             }
-
-            SortOrder order;
-            switch(sortOrder) {
-                case 1: {
-                    order = SortOrder::ASCENDING;
-                    break;
-                }
-                case 2: {
-                    order = SortOrder::DESCENDING;
-                    break;
-                }
-                default: {
-                    std::cout << "Invalid sort order\n";
-                    break;
+        } else {
+            for (const CartLine& line : lines) {
+                Product* product = g_ProductManager.getProduct(line.productID);
+                if (product && cart.addProductToCart(product, line.quantity)) {
+                    added++;
                 }
             }
-
-            g_ProductManager.sortProducts(sortType, order);
-            showProductCatalog();
-            break;
         }
-        case 2: {
-            std::cout << "Enter product id: ";
+        auto middle = std::chrono::steady_clock::now();
 
-            int productID;
-            std::cin >> productID;
-
-            Product* product = g_ProductManager.getProduct(productID);
-            if (!product) {
-                std::cout << "Invalid product id\n";
-                break;
+        if (batched) {
+            cart.removeProductsFromCart(removals);
+        } else {
+            for (int productID : removals) {
+                cart.removeProductFromCart(productID);
             }
+        }
+        auto end = std::chrono::steady_clock::now();
 
-            again:
+        Benchmark::Line(3).label(batched ? "batched" : "per line", 10) << ": add " << lineCount << " lines in "
+            << std::chrono::duration<double, std::milli>(middle - start).count() << " ms (" << added << " added), remove "
+            << removals.size() << " products in " << std::chrono::duration<double, std::milli>(end - middle).count() << " ms, "
+            << cart.getCartSize() << " lines left\n";
+    }
+}
 
-            std::cout << "Enter quantity: ";
-            int quantity;
-            std::cin >> quantity;
+void runArchiveBenchmark(int orderCount)
+{
+    Random::SetSeed(5);
+
+    // With COUNT_ALLOCATIONS the bytes the orders allocate are measured;
+    // otherwise each order is assumed to take sizeof(Order).
+    std::vector<Order*> placed;
+    placed.reserve(orderCount);
+    uint64_t allocatedBytes = AllocationCounter::Bytes();
+    for (int i = 0; i < orderCount; i++) {
+        Order* order = new Order();
+        order->setCheckedOut(true);
+        order->setProductID(Random::Gen(1, 100000));
+        order->setQuantity(Random::Gen(1, 5));
+        order->setShippingCost(Random::Gen(10, 100));
+        placed.push_back(order);
+    }
+    size_t orderBytes = AllocationCounter::Enabled() ? AllocationCounter::Bytes() - allocatedBytes : placed.size() * sizeof(Order);
 
-            if (!g_ShoppingCart.addProductToCart(product, quantity))
-            {
-                goto again;
-                break;
-            }
+    Orders orders;
+    for (Order* order : placed) {
+        orders.addOrder(order);
+    }
 
-            std::cout << "Product added to cart\n";
-            break;
+    const int probes = 100;
+    auto scanLive = [&]() {
+        int64_t total = 0;
+        orders.forEachOrder([&](Order* order) {
+            total += order->getShippingCost();
+        });
+        for (int probe = 0; probe < probes; probe++) {
+            orders.forEachOrder([&](Order* order) {
+                if (order->getOrderID() >= probe * 5000 + 17 && order->getOrderID() <= probe * 5000 + 3017) {
+                    total += order->getShippingCost();
+                }
+            });
         }
-        case 3: {
-            break;
+        for (int probe = 0; probe < probes; probe++) {
+            int productID = 1 + probe * 997;
+            orders.forEachOrder([&](Order* order) {
+                if (order->getProductID() == productID) {
+                    total += order->getQuantity();
+                }
+            });
         }
-        default: {
-            std::cout << "Invalid choice\n";
-            break;
+        return total;
+    };
+
+    auto scanArchive = [&]() {
+        const OrderArchive& archive = orders.getArchive();
+        int64_t total = archive.totalShippingCost();
+        for (int probe = 0; probe < probes; probe++) {
+            total += archive.shippingCostForOrderRange(probe * 5000 + 17, probe * 5000 + 3017);
         }
+        for (int probe = 0; probe < probes; probe++) {
+            total += archive.totalQuantityForProduct(1 + probe * 997);
+        }
+        return total;
+    };
+
+    auto report = [&](const char* name, size_t bytes, auto&& scan) {
+        int64_t checksum = 0;
+        double seconds = Benchmark::Seconds([&]() {
+            checksum = scan();
+        });
+        Benchmark::Line(2).label(name, 8) << ": " << bytes << " bytes (" << (double)bytes / orderCount << " bytes/order), "
+            << "shipping total, " << probes << " order-range and " << probes << " product scans in " << std::setprecision(3)
+            << seconds * 1000.0 << " ms, checksum " << checksum << "\n";
+    };
+
+    size_t liveBytes = orderBytes + orders.liveIndexBytes();
+    report("live", liveBytes, scanLive);
+
+    orders.archiveOrders(0);
+    size_t archiveBytes = orders.getArchive().memoryBytes() + orders.liveIndexBytes();
+    report("archive", archiveBytes, scanArchive);
+
+    Benchmark::Line(1) << "Reduction: " << (double)liveBytes / archiveBytes << "x over "
+        << orders.getArchive().getBlockCount() << " blocks"
+        << (AllocationCounter::Enabled() ? " (live orders measured by COUNT_ALLOCATIONS)\n" :
+            " (estimate: live orders taken as sizeof(Order) each; build with COUNT_ALLOCATIONS=1 to measure)\n");
+}
+
+void runExportBenchmark(int productCount, int orderCount)
+{
+    Random::SetSeed(6);
+    populateSyntheticCatalog(g_ProductManager, productCount);
+    for (int i = 0; i < orderCount; i++) {
+        Order* order = new Order();
+        order->setCheckedOut(true);
+        order->setProductID(Random::Gen(1, productCount));
+        order->setQuantity(Random::Gen(1, 5));
+        order->setShippingCost(Random::Gen(10, 100));
+        g_Orders.addOrder(order);
+    }
+
+    std::string directory = std::getenv("TMPDIR") ? std::getenv("TMPDIR") : "/tmp";
+    std::string textPath = directory + "/bench-export.txt";
+    std::string catalogPath = directory + "/bench-catalog.col";
+    std::string ordersPath = directory + "/bench-orders.col";
+
+    auto fileSize = [](const std::string& path) {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        return (uint64_t)file.tellg();
+    };
+
+    auto report = [](const char* name, uint64_t bytes, double seconds) {
+        Benchmark::Line(1).label(name, 9) << ": " << bytes << " bytes in " << seconds * 1000.0 << " ms ("
+            << std::setprecision(3) << bytes / seconds / 1e9 << " GB/s)\n";
+    };
+
+    double textSeconds = Benchmark::Seconds([&]() {
+        std::ofstream text(textPath);
+        printProductCatalog(text);
+        printPendingOrders(text);
+    });
+    report("text", fileSize(textPath), textSeconds);
+
+    bool ok = false;
+    double columnarSeconds = Benchmark::Seconds([&]() {
+        ok = exportCatalogColumnar(catalogPath.c_str(), g_ProductManager) &&
+            exportOrdersColumnar(ordersPath.c_str(), g_Orders);
+    });
+    report("columnar", fileSize(catalogPath) + fileSize(ordersPath), columnarSeconds);
+
+    if (!ok) {
+        std::cout << "Columnar export failed\n";
     }
+    Benchmark::Line(1) << "Speedup: " << textSeconds / columnarSeconds << "x\n";
+
+    std::remove(textPath.c_str());
+    std::remove(catalogPath.c_str());
+    std::remove(ordersPath.c_str());
 }
 
-void showShoppingCart()
+// Runs sessions through the in-process channel or, with overSockets, through
+// a SessionServer on a temporary Unix domain socket in this process. A
+// thread count of 0 keeps the scheduler's default.
+void runSessionBenchmark(int sessions, int concurrency, unsigned int threads, bool overSockets)
 {
-    clear();
+    populateSyntheticCatalog(g_ProductManager, 10000);
 
-    std::cout << "Shopping Cart (" << g_ShoppingCart.getCartSize() << ")\n";
+    if (threads > 0) {
+        TaskScheduler::Options options;
+        options.threads = threads;
+        g_TaskScheduler.configure(options);
+    }
+    std::shared_ptr<SessionLoad> load = std::make_shared<SessionLoad>(sessions, concurrency);
+
+#if defined(__linux__)
+    // Both ends of every connection live in this process.
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
 
-    Tabulator<int, std::string, int, int, int, int> tabulator({"ID", "Name", "Price", "Quantity", "Product Cost", "Total Cost"});
-    tabulator.setColumnFormat({ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::AUTO});
+    SessionReactor reactor;
+    SessionServer server(reactor);
+    std::string path = (std::getenv("TMPDIR") ? std::getenv("TMPDIR") : "/tmp") + std::string("/sessions-") + std::to_string(getpid()) + ".sock";
+    if (overSockets && !server.listen(path)) {
+        std::cout << "Could not listen on " << path << "\n";
+        return;
+    }
+#else
+    if (overSockets) {
+        std::cout << "Unix domain socket sessions need Linux\n";
+        return;
+    }
+#endif
 
-    for (Order* order : g_ShoppingCart.getCart()) {
-        Product* product = g_ProductManager.getProduct(order->getProductID());
-        if (!product) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < concurrency; i++) {
+#if defined(__linux__)
+        if (overSockets) {
+            runShopper(SocketSessionChannel(reactor, path), load, i);
             continue;
         }
-        tabulator.addRow(product->getID(), product->getName(), product->getPrice(), order->getQuantity(), order->getProductCost(), order->getTotalCost());
+#endif
+        runShopper(InProcessSessionChannel(), load, i);
     }
+    load->done.wait();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-    tabulator.print(std::cout);
+#if defined(__linux__)
+    server.stop();
+#endif
 
-    std::cout << "Total Product Cost: " << g_ShoppingCart.getTotalProductCost() << std::endl;
-    std::cout << "Total Cost: " << g_ShoppingCart.getTotalCost() << std::endl;
+    std::vector<uint64_t> all;
+    for (const std::vector<uint64_t>& shopper : load->latencies) {
+        all.insert(all.end(), shopper.begin(), shopper.end());
+    }
+    std::sort(all.begin(), all.end());
+    auto percentile = [&all](double p) {
+        return all.empty() ? 0.0 : all[std::min(all.size() - 1, (size_t)(p * all.size()))] / 1000.0;
+    };
+
+    std::cout << (overSockets ? "unix sockets" : "in-process") << ", " << g_TaskScheduler.getThreadCount() << " threads, "
+              << concurrency << " concurrent shoppers\n";
+    Benchmark::Line(3) << load->completed.load() << " sessions in " << seconds << " s (" << std::setprecision(0)
+        << load->completed.load() / seconds << " sessions/sec), " << load->failed.load() << " failed\n";
+    Benchmark::Line(1) << "checkout latency: p50 " << percentile(0.5) << " us, p99 " << percentile(0.99)
+        << " us, max " << (all.empty() ? 0.0 : all.back() / 1000.0) << " us\n";
+    TaskScheduler::Stats stats = g_TaskScheduler.getStats();
+    std::cout << stats.injected << " resumptions, " << stats.stolen << " steals, " << g_Orders.size() << " orders placed\n";
+}
 
-    std::cout << "What would you like to do?\n";
-    std::cout << "1 - Checkout\n";
-    std::cout << "2 - Remove Product\n";
-    std::cout << "3 - Back\n";
+#if defined(__linux__)
+// Serves sessions on a Unix domain socket until stdin is closed. Try it with
+// `socat - UNIX-CONNECT:<path>`.
+int runSessionServer(const std::string& path, unsigned int threads)
+{
+    g_ProductManager.initDefaults();
 
-    int choice;
-    std::cin >> choice;
+    if (threads > 0) {
+        TaskScheduler::Options options;
+        options.threads = threads;
+        g_TaskScheduler.configure(options);
+    }
+    SessionReactor reactor;
+    SessionServer server(reactor);
+    if (!server.listen(path)) {
+        std::cout << "Could not listen on " << path << "\n";
+        return 1;
+    }
 
-    switch(choice) {
-        case 1: {
-            g_ShoppingCart.checkout();
-            std::cout << "Checkout successful\n";
-            break;
+    std::cout << "Serving sessions on " << path << " with " << g_TaskScheduler.getThreadCount() << " threads, close stdin to stop\n";
+    std::string line;
+    while (std::getline(std::cin, line)) {
+    }
+
+    server.stop();
+    std::cout << server.getSessionsServed() << " sessions served, " << g_Orders.size() << " orders placed\n";
+    return 0;
+}
+#endif
+
+void runSchedulerBenchmark(unsigned int maxThreads)
+{
+    const size_t spawnTasks = 1 << 20;
+    const size_t unevenItems = 1 << 14;
+    std::vector<int32_t> values(1 << 24);
+    Random::Fill(values.data(), values.size(), 0, 1000);
+
+    uint64_t serialSum = 0;
+    double serialSeconds = Benchmark::Seconds([&]() {
+        for (int32_t value : values) {
+            serialSum += value;
         }
-        case 2: {
-            std::cout << "Enter product id: ";
-            int productID;
-            std::cin >> productID;
+    });
+    Benchmark::Line(2) << "serial sum: " << values.size() * sizeof(int32_t) / serialSeconds / 1e9 << " GB/s\n";
+
+    populateSyntheticCatalog(g_ProductManager, 200000);
+    g_ProductManager.setSearchCacheEnabled(false);
+    std::ostream discard(nullptr);
+
+    // Every 64th item is 100x more expensive, so even splits leave some
+    // workers idle unless they steal.
+    auto uneven = [](size_t item) {
+        uint64_t state = item + 1;
+        int rounds = item % 64 == 0 ? 20000 : 200;
+        for (int i = 0; i < rounds; i++) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+        }
+        return state;
+    };
+
+    for (unsigned int threads = 1; threads <= maxThreads; threads *= 2) {
+        TaskScheduler::Options options;
+        options.threads = threads;
+        g_TaskScheduler.configure(options);
+        g_TaskScheduler.getThreadCount();
+
+        std::cout << threads << " threads\n";
+
+        g_TaskScheduler.resetStats();
+        std::atomic<uint64_t> leaves { 0 };
+        double seconds = Benchmark::Seconds([&leaves]() {
+            Parallel::For(0, spawnTasks, 1, [&leaves](size_t, size_t) {
+                leaves.fetch_add(1, std::memory_order_relaxed);
+            });
+        });
+        TaskScheduler::Stats stats = g_TaskScheduler.getStats();
+        Benchmark::Line(1) << "  spawn+join : " << seconds * 1e9 / stats.spawned << " ns/task over "
+            << stats.spawned << " tasks, " << stats.stolen << " stolen\n";
+
+        g_TaskScheduler.resetStats();
+        std::atomic<uint64_t> checksum { 0 };
+        seconds = Benchmark::Seconds([&]() {
+            Parallel::For(0, unevenItems, 16, [&](size_t begin, size_t end) {
+                uint64_t local = 0;
+                for (size_t item = begin; item < end; item++) {
+                    local += uneven(item);
+                }
+                checksum.fetch_add(local, std::memory_order_relaxed);
+            });
+        });
+        stats = g_TaskScheduler.getStats();
+        Benchmark::Line(2) << "  uneven for : " << seconds * 1000.0 << " ms, " << stats.stolen << " steals ("
+            << std::setprecision(0) << stats.stolen / seconds << "/s, " << std::setprecision(1)
+            << 100.0 * stats.stolen / std::max<uint64_t>(1, stats.executed) << "% of tasks), "
+            << stats.stealAttempts - stats.stolen << " failed attempts\n";
+
+        uint64_t sum = 0;
+        seconds = Benchmark::Seconds([&]() {
+            sum = Parallel::Reduce(0, values.size(), 1 << 16, (uint64_t)0, [&values](size_t begin, size_t end) {
+                uint64_t local = 0;
+                for (size_t i = begin; i < end; i++) {
+                    local += values[i];
+                }
+                return local;
+            }, [](uint64_t a, uint64_t b) {
+                return a + b;
+            });
+        });
+        Benchmark::Line(2) << "  reduce sum : " << values.size() * sizeof(int32_t) / seconds / 1e9 << " GB/s"
+            << (sum == serialSum ? "" : " (MISMATCH)") << "\n";
+
+        double sortMs = Benchmark::Seconds([]() {
+            g_ProductManager.sortProducts(SortType::PRICE, SortOrder::DESCENDING);
+            g_ProductManager.sortProducts(SortType::ID, SortOrder::ASCENDING);
+        }) * 1000.0 / 2;
+        double searchMs = Benchmark::Seconds([]() {
+            g_ProductManager.getProductsWithString("an");
+        }) * 1000.0;
+        double renderMs = Benchmark::Seconds([&discard]() {
+            printProductCatalog(discard);
+        }) * 1000.0;
+        Benchmark::Line(1) << "  200k catalog: sort " << sortMs << " ms, search " << searchMs << " ms, render " << renderMs << " ms\n";
+    }
+}
 
-            g_ShoppingCart.removeProductFromCart(productID);
-            std::cout << "Product removed from cart\n";
-            break;
+void runRandomBenchmark()
+{
+    const uint64_t totalDraws = 1ull << 25;
+    const unsigned int threadCounts[] = {1, 2, 4, 8, 16, 32, 64};
+
+    {
+        std::mt19937 generator(1);
+        int64_t sink = 0;
+        double seconds = Benchmark::Seconds([&]() {
+            for (uint64_t i = 0; i < totalDraws; i++) {
+                std::uniform_int_distribution<int32_t> distrib(10, 100);
+                sink += distrib(generator);
+            }
+        });
+        std::cout << "mt19937 baseline threads= 1: " << (uint64_t)(totalDraws / seconds) << " draws/sec (sink " << sink % 10 << ")\n";
+    }
+
+    for (int bulk = 0; bulk < 2; bulk++) {
+        for (unsigned int threadCount : threadCounts) {
+            Random::SetSeed(42);
+            std::atomic<int64_t> sink { 0 };
+            std::vector<std::thread> threads;
+
+            auto start = std::chrono::steady_clock::now();
+            for (unsigned int t = 0; t < threadCount; t++) {
+                threads.emplace_back([&, t] {
+                    Random::SetThreadStream(t);
+                    const uint64_t draws = totalDraws / threadCount;
+                    int64_t local = 0;
+                    if (bulk) {
+                        int32_t buffer[4096];
+                        for (uint64_t done = 0; done < draws; done += 4096) {
+                            Random::Fill(buffer, 4096, 10, 100);
+                            local += buffer[done % 4093];
+                        }
+                    } else {
+                        for (uint64_t i = 0; i < draws; i++) {
+                            local += Random::Gen(10, 100);
+                        }
+                    }
+                    sink += local;
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            std::cout << (bulk ? "Random::Fill    " : "Random::Gen     ") << " threads=" << std::setw(2) << threadCount
+                      << ": " << (uint64_t)(totalDraws / seconds) << " draws/sec (sink " << sink % 10 << ")\n";
         }
-        case 3: {
-            break;
+    }
+}
+
+// Headless workload for profile-guided builds (the pgo-train target in
+// CMakeLists.txt): a generated session mix of catalog load, searches,
+// sorts, cart traffic, checkouts and screen renders replayed against the
+// store classes, then fuzzy search and catalog paging, which the mix
+// leaves out.
+int runPgoTraining(size_t eventCount, int catalogSize)
+{
+    Random::SetSeed(1);
+    Random::SetThreadStream(0);
+
+    ReplayDriver driver(g_ShoppingCart);
+    driver.run(ReplayLog::Generate(eventCount, catalogSize, 1));
+
+    static const char* queries[] = {"banana", "aple", "grap", "melon", "chery", "kiwi", "Orang", "coconut"};
+    uint64_t matches = 0;
+    g_ProductManager.setSearchCacheEnabled(false);
+    for (int round = 0; round < 20; round++) {
+        for (const char* query : queries) {
+            matches += g_ProductManager.getProductsFuzzy(query).size();
         }
-        default: {
-            std::cout << "Invalid choice\n";
-            break;
+    }
+    g_ProductManager.setSearchCacheEnabled(true);
+
+    std::ostringstream sink;
+    size_t productCount = g_ProductManager.getProducts().size();
+    for (size_t first = 0; first < productCount; first += CATALOG_PAGE_ROWS) {
+        sink.str("");
+        printProductCatalogPage(sink, first, CATALOG_PAGE_ROWS);
+    }
+
+    driver.printReport(std::cout);
+    std::cout << "Fuzzy matches: " << matches << "\n";
+    return 0;
+}
+
+// The hot paths guarded by --perf-check. Each result is the best of several
+// runs in microseconds per operation, which stays steady enough on a quiet
+// machine to tell a real slowdown from noise.
+std::vector<std::pair<std::string, double>> runPerfSuite()
+{
+    const int catalogSize = 20000;
+    const int repetitions = 7;
+
+    struct PerfCase {
+        const char* name;
+        int operations;
+        std::function<void()> run;
+    };
+
+    static const char* queries[] = {"ba", "Ap", "na", "or", "gra", "pi", "me", "lon", "ber", "Che", "co", "ki", "wi", "mo"};
+    static const char* fuzzyQueries[] = {"banana", "aple", "grap", "melon", "chery", "kiwi"};
+    const size_t queryCount = sizeof(queries) / sizeof(queries[0]);
+    const size_t fuzzyQueryCount = sizeof(fuzzyQueries) / sizeof(fuzzyQueries[0]);
+
+    Random::SetSeed(5);
+    Random::SetThreadStream(0);
+    populateSyntheticCatalog(g_ProductManager, catalogSize);
+    g_ProductManager.setSearchCacheEnabled(false);
+
+    std::ostringstream sink;
+    ShoppingCart cart;
+    uint64_t checksum = 0;
+    size_t round = 0;
+
+    std::vector<PerfCase> cases = {
+        {"catalog_render", 10, [&] {
+            sink.str("");
+            printProductCatalog(sink);
+            checksum += (uint64_t)sink.tellp();
+        }},
+        {"catalog_page", 2000, [&] {
+            sink.str("");
+            printProductCatalogPage(sink, catalogSize / 2, CATALOG_PAGE_ROWS);
+            checksum += (uint64_t)sink.tellp();
+        }},
+        {"search", 100, [&] {
+            checksum += g_ProductManager.getProductsWithString(queries[round++ % queryCount]).size();
+        }},
+        {"fuzzy_search", 20, [&] {
+            checksum += g_ProductManager.getProductsFuzzy(fuzzyQueries[round++ % fuzzyQueryCount]).size();
+        }},
+        {"sort", 6, [&] {
+            if (round++ % 2) {
+                g_ProductManager.sortProducts(SortType::PRICE, SortOrder::ASCENDING);
+            } else {
+                g_ProductManager.sortProducts(SortType::STOCK_AMOUNT, SortOrder::DESCENDING);
+            }
+        }},
+        {"cart_checkout", 50, [&] {
+            for (int i = 0; i < 100; i++) {
+                cart.addProductToCart(g_ProductManager.getProduct(1 + (i * 193) % catalogSize), 1);
+            }
+            checksum += (uint64_t)cart.getTotalCost();
+            cart.checkout();
+        }},
+    };
+
+    std::vector<std::pair<std::string, double>> results;
+    for (PerfCase& perfCase : cases) {
+        perfCase.run();
+
+        double best = std::numeric_limits<double>::max();
+        for (int repetition = 0; repetition < repetitions; repetition++) {
+            double seconds = Benchmark::Seconds([&perfCase]() {
+                for (int i = 0; i < perfCase.operations; i++) {
+                    perfCase.run();
+                }
+            });
+            best = std::min(best, seconds * 1e6 / perfCase.operations);
         }
+        results.emplace_back(perfCase.name, best);
     }
+
+    g_ProductManager.setSearchCacheEnabled(true);
+    std::cout << "Perf suite checksum " << checksum << "\n";
+    return results;
 }
 
-void showPendingOrders()
+int recordPerfBaseline(const char* path)
 {
-    clear();
+    std::vector<std::pair<std::string, double>> results = runPerfSuite();
 
-    std::cout << "Pending Orders (" << g_Orders.size() << ")\n";
+    std::ofstream file(path);
+    file << "# Best-of-run microseconds per operation, written by --perf-record.\n";
+    for (auto& [name, micros] : results) {
+        file << name << ' ' << micros << '\n';
+        std::cout << name << ' ' << micros << " us\n";
+    }
 
-    Tabulator<int, int, std::string, int, int, int, int> tabulator({"Order ID", "Product ID", "Name", "Quantity", "Shipping Cost", "Product Cost", "Total Cost"});
-    tabulator.setColumnFormat({ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::AUTO});
+    if (!file) {
+        std::cout << "Failed to write " << path << "\n";
+        return 1;
+    }
+    std::cout << "Baseline written to " << path << "\n";
+    return 0;
+}
+
+// Fails when any hot path is more than thresholdPercent slower than the
+// baseline. Paths missing from the baseline are reported but never fail.
+int checkPerfBaseline(const char* path, double thresholdPercent)
+{
+    std::ifstream file(path);
+    if (!file) {
+        std::cout << "No baseline at " << path << "; record one on this machine with --perf-record first\n";
+        return 1;
+    }
 
-    for (int i = 0; i < g_Orders.getLastOrderID(); i++) {
-        Order* order = g_Orders.getOrder(i);
-        if (!order) {
+    std::vector<std::pair<std::string, double>> baseline;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
             continue;
         }
-        tabulator.addRow(order->getOrderID(), order->getProductID(), order->getProductName(), order->getQuantity(), order->getShippingCost(), order->getProductCost(), order->getTotalCost());
+        std::istringstream fields(line);
+        std::string name;
+        double micros = 0;
+        if (fields >> name >> micros) {
+            baseline.emplace_back(name, micros);
+        }
+    }
+
+    std::vector<std::pair<std::string, double>> results = runPerfSuite();
+
+    Tabulator<std::string, double, double, double, std::string> tabulator({"Hot Path", "Baseline us", "Current us", "Change %", "Status"}, 10);
+    tabulator.setColumnFormat({ColumnFormat::AUTO, ColumnFormat::FIXED, ColumnFormat::FIXED, ColumnFormat::FIXED, ColumnFormat::AUTO});
+    tabulator.setColumnPrecision({0, 2, 2, 1, 0});
+
+    int regressions = 0;
+    for (auto& [name, micros] : results) {
+        auto expected = std::find_if(baseline.begin(), baseline.end(), [&name](const auto& entry) {
+            return entry.first == name;
+        });
+        if (expected == baseline.end()) {
+            tabulator.addRow(name, 0.0, micros, 0.0, "new");
+            continue;
+        }
+
+        double change = (micros / expected->second - 1.0) * 100.0;
+        bool regressed = change > thresholdPercent;
+        regressions += regressed ? 1 : 0;
+        tabulator.addRow(name, expected->second, micros, change, regressed ? "REGRESSED" : "ok");
     }
 
     tabulator.print(std::cout);
+    std::cout.unsetf(std::ios_base::floatfield);
+    std::cout.precision(6);
 
-    std::cout << "What would you like to do?\n";
-    std::cout << "1 - Remove Order\n";
-    std::cout << "2 - Back\n";
+    if (regressions > 0) {
+        std::cout << regressions << " hot path(s) slowed down by more than " << thresholdPercent << "%\n";
+        return 1;
+    }
+    std::cout << "No hot path slowed down by more than " << thresholdPercent << "%\n";
+    return 0;
+}
 
-    int choice;
-    std::cin >> choice;
+// On/off switches such as TERMINAL_DIFF=1: unset, empty, 0, false, no and
+// off mean off.
+bool envFlag(const char* name)
+{
+    const char* value = std::getenv(name);
+    if (!value) {
+        return false;
+    }
+    std::string flag = value;
+    std::transform(flag.begin(), flag.end(), flag.begin(), [](unsigned char c) {
+        return (char)std::tolower(c);
+    });
+    return !flag.empty() && flag != "0" && flag != "false" && flag != "no" && flag != "off";
+}
 
-    switch(choice) {
-        case 1: {
-            std::cout << "Enter order id: ";
-            int orderID;
-            std::cin >> orderID;
+// tests/store_tests.cpp compiles this file with STORE_NO_MAIN and brings its
+// own main().
+#ifndef STORE_NO_MAIN
 
-            g_Orders.removeOrder(orderID);
-            std::cout << "Order removed\n";
-            break;
+int main(int argc, char** argv) {
+
+    if (argc > 1) {
+        std::string command = argv[1];
+
+        if (command == "--bench-random") {
+            runRandomBenchmark();
+            return 0;
         }
-        case 2: {
-            break;
+
+        if (command == "--bench-render") {
+            runRenderBenchmark(argc > 2 ? std::stoi(argv[2]) : 1000, argc > 3 ? std::stoi(argv[3]) : 100);
+            return 0;
         }
-        default: {
-            std::cout << "Invalid choice\n";
-            break;
+
+        if (command == "--bench-search-cache") {
+            runSearchCacheBenchmark(argc > 2 ? std::stoi(argv[2]) : 50000, argc > 3 ? std::stoi(argv[3]) : 10000);
+            return 0;
         }
-    }
-}
 
-bool showMenu() {
-    std::cout << "What would you like to do?\n";
-    std::cout << "1 - View Product Catalog\n";
-    std::cout << "2 - View Shopping Cart\n";
-    std::cout << "3 - View Pending Orders\n";
-    std::cout << "4 - Exit\n";
-    std::cout << "Enter choice: ";
+        if (command == "--bench-fuzzy") {
+            runFuzzyBenchmark(argc > 2 ? std::stoi(argv[2]) : 1000000, argc > 3 ? std::stoi(argv[3]) : 200);
+            return 0;
+        }
 
-    int choice;
-    std::cin >> choice;
+        if (command == "--bench-sharded") {
+            runShardedBenchmark(argc > 2 ? std::stoi(argv[2]) : 100000, argc > 3 ? std::stoi(argv[3]) : 200000);
+            return 0;
+        }
 
-    switch(choice) {
-        case 1: {
-            showProductCatalog();
-            break;
+        if (command == "--bench-cart-batch") {
+            runCartBatchBenchmark(argc > 2 ? std::stoi(argv[2]) : 20000);
+            return 0;
         }
-        case 2: {
-            showShoppingCart();
-            break;
+
+        if (command == "--bench-archive") {
+            runArchiveBenchmark(argc > 2 ? std::stoi(argv[2]) : 1000000);
+            return 0;
         }
-        case 3: {
-            showPendingOrders();
-            break;
+
+        if (command == "--bench-alloc") {
+            runAllocationBenchmark(argc > 2 ? std::stoi(argv[2]) : 10000, argc > 3 ? std::stoi(argv[3]) : 50);
+            return 0;
         }
-        case 4: {
-            return false;
+
+        if (command == "--bench-window") {
+            runWindowBenchmark(argc > 2 ? std::stoi(argv[2]) : 1000000, argc > 3 ? std::stoi(argv[3]) : 5);
+            return 0;
         }
-        default: {
-            std::cout << "Invalid choice\n";
-            break;
+
+        if (command == "--bench-scheduler") {
+            runSchedulerBenchmark(argc > 2 ? (unsigned int)std::stoi(argv[2]) : std::max(4u, std::thread::hardware_concurrency()));
+            return 0;
         }
-    }
 
-    return true;
-}
+        if (command == "--bench-sessions") {
+            runSessionBenchmark(argc > 2 ? std::stoi(argv[2]) : 20000, argc > 3 ? std::stoi(argv[3]) : 1000,
+                argc > 4 ? (unsigned int)std::stoi(argv[4]) : 0, argc > 5 && std::string(argv[5]) == "socket");
+            return 0;
+        }
+
+#if defined(__linux__)
+        if (command == "--serve-sessions" && argc > 2) {
+            return runSessionServer(argv[2], argc > 3 ? (unsigned int)std::stoi(argv[3]) : 0);
+        }
+#endif
+
+        if (command == "--bench-export") {
+            runExportBenchmark(argc > 2 ? std::stoi(argv[2]) : 200000, argc > 3 ? std::stoi(argv[3]) : 1000000);
+            return 0;
+        }
+
+        if (command == "--columnar-info" && argc > 2) {
+            return printColumnarInfo(argv[2]);
+        }
+
+        if (command == "--pgo-train") {
+            return runPgoTraining(argc > 2 ? std::stoul(argv[2]) : 10000, argc > 3 ? std::stoi(argv[3]) : 5000);
+        }
 
-int main() {
+        if (command == "--perf-record" && argc > 2) {
+            return recordPerfBaseline(argv[2]);
+        }
+
+        if (command == "--perf-check" && argc > 2) {
+            return checkPerfBaseline(argv[2], argc > 3 ? std::stod(argv[3]) : 15.0);
+        }
+
+        if (command == "--replay" && argc > 2) {
+            return runReplay(argv[2], argc > 3 ? std::stoull(argv[3]) : 1);
+        }
+
+        if (command == "--replay-generate" && argc > 4) {
+            std::vector<ReplayEvent> events = ReplayLog::Generate(std::stoul(argv[3]), std::stoi(argv[4]), 1);
+            bool binary = argc > 5 && std::string(argv[5]) == "binary";
+            return (binary ? ReplayLog::SaveBinary(argv[2], events) : ReplayLog::SaveText(argv[2], events)) ? 0 : 1;
+        }
 
-    clear();
+        std::cout << "Unknown option: " << command << "\n";
+        return 1;
+    }
 
-    std::cout << "Welcome to Coffee's Online Store\n";
+    g_Terminal.setDiffEnabled(envFlag("TERMINAL_DIFF"));
+    startMetricsExport();
+    startOrderArchiving();
+    g_Terminal.beginFrame() << "Welcome to Coffee's Online Store\n";
     g_ProductManager.initDefaults();
 
     while(showMenu()) {}
 
-    std::cout << "Thank you for shopping at Coffee's Online Store\n"
-                 "See you again soon!\n\n";
+    g_Terminal.out() << "Thank you for shopping at Coffee's Online Store\n"
+                        "See you again soon!\n\n";
+    g_Terminal.flush();
+
+    if (envFlag("TERMINAL_STATS")) {
+        g_Terminal.printStats(std::cout);
+    }
+
+#if ENABLE_TRACING
+    const char* tracePath = std::getenv("TRACE_OUTPUT");
+    if (!tracePath) {
+        tracePath = "trace.json";
+    }
+    if (Trace::WriteChromeJson(tracePath)) {
+        std::cout << "Trace written to " << tracePath << "\n";
+    }
+#endif
+
     return 0;
-}
\ No newline at end of file
+}
+
+#endif
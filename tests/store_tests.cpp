@@ -0,0 +1,1244 @@
+// Unit tests for the store. main.cpp is compiled in with STORE_NO_MAIN,
+// COUNT_ALLOCATIONS=1 and ENABLE_TRACING=1 (see CMakeLists.txt), so every
+// class is reachable here. Each test is registered with ctest under its own
+// name:
+//
+//   store_tests              runs every test
+//   store_tests <name>...    runs the named tests
+//
+// A failed CHECK prints the expression and keeps going; the process exits
+// non-zero if any check failed.
+#include "../main.cpp"
+
+#include <filesystem>
+#include <set>
+
+static int g_Failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::cout << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed\n"; \
+            g_Failures++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(actual, expected) \
+    do { \
+        auto actualValue = (actual); \
+        auto expectedValue = (expected); \
+        if (!(actualValue == expectedValue)) { \
+            std::cout << __FILE__ << ":" << __LINE__ << ": CHECK_EQ(" #actual ", " #expected ") failed: got " \
+                      << actualValue << ", expected " << expectedValue << "\n"; \
+            g_Failures++; \
+        } \
+    } while (0)
+
+// A file in the temporary directory that is removed again when the test is
+// done with it.
+class TempFile {
+
+    public:
+    explicit TempFile(const std::string& name) {
+        m_Path = (std::filesystem::temp_directory_path() / ("store-tests-" + std::to_string(getpid()) + "-" + name)).string();
+    }
+
+    ~TempFile() {
+        std::remove(m_Path.c_str());
+    }
+
+    const char* path() const {
+        return m_Path.c_str();
+    }
+
+    void write(const std::string& contents) const {
+        std::ofstream file(m_Path, std::ios::binary | std::ios::trunc);
+        file << contents;
+    }
+
+    std::string read() const {
+        std::ifstream file(m_Path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    private:
+    std::string m_Path;
+};
+
+// Products named "<prefix> <i>" with distinct prices and stock amounts that
+// do not follow the ID order.
+static void addNumberedProducts(ProductManager& productManager, int count, const std::string& prefix = "Product") {
+    for (int i = 0; i < count; i++) {
+        Product* product = new Product();
+        product->setName(prefix + " " + std::to_string(i));
+        product->setDescription("Test product " + std::to_string(i));
+        product->setPrice((int)((int64_t)i * 7919 % count) + 1);
+        product->setStockAmount((int)((int64_t)i * 104729 % count));
+        productManager.addProduct(product);
+    }
+}
+
+static int sortKey(Product* product, SortType sortType) {
+    return sortType == SortType::PRICE ? product->getPrice() :
+        sortType == SortType::STOCK_AMOUNT ? product->getStockAmount() : product->getID();
+}
+
+static bool isSorted(std::span<Product* const> products, SortType sortType, SortOrder sortOrder) {
+    return std::is_sorted(products.begin(), products.end(), ProductComparator{sortType, sortOrder});
+}
+
+static std::vector<std::string> splitLines(const std::string& text) {
+    std::vector<std::string> lines;
+    std::istringstream stream(text);
+    std::string line;
+    while (std::getline(stream, line)) {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+static void testTraceRing() {
+    static const char* names[] = {"even", "odd"};
+
+    Trace::ThreadBuffer partial(1);
+    for (uint64_t i = 0; i < 3; i++) {
+        partial.push(names[i % 2], i, 2 * i);
+    }
+    size_t partialCount = 0;
+    partial.forEach([&](const Trace::Event& event) {
+        CHECK_EQ(event.startNs, (uint64_t)partialCount);
+        partialCount++;
+    });
+    CHECK_EQ(partialCount, (size_t)3);
+
+    // Past CAPACITY the oldest spans are overwritten and forEach yields the
+    // newest CAPACITY of them, oldest first.
+    const uint64_t total = Trace::ThreadBuffer::CAPACITY + 100;
+    Trace::ThreadBuffer wrapped(2);
+    for (uint64_t i = 0; i < total; i++) {
+        wrapped.push(names[i % 2], i, 2 * i);
+    }
+
+    std::vector<Trace::Event> events;
+    wrapped.forEach([&](const Trace::Event& event) {
+        events.push_back(event);
+    });
+    CHECK_EQ(events.size(), Trace::ThreadBuffer::CAPACITY);
+    CHECK_EQ(events.front().startNs, (uint64_t)100);
+    CHECK_EQ(events.back().startNs, total - 1);
+
+    bool consistent = true;
+    for (size_t i = 0; i < events.size(); i++) {
+        uint64_t start = 100 + i;
+        consistent = consistent && events[i].startNs == start && events[i].durationNs == 2 * start &&
+            events[i].name == names[start % 2];
+    }
+    CHECK(consistent);
+
+    // Spans recorded on another thread end up in the Chrome JSON dump.
+    std::thread([]() {
+        TRACE_SCOPE("store_tests span");
+    }).join();
+    std::ostringstream json;
+    Trace::WriteChromeJson(json);
+    CHECK(json.str().find("{\"name\":\"store_tests span\",\"ph\":\"X\"") != std::string::npos);
+    CHECK(json.str().find("\n]}\n") != std::string::npos);
+
+    // Checkout adds the cart as one batch, with a span per order inside it.
+    ProductManager products;
+    addNumberedProducts(products, 2);
+    ShoppingCart cart;
+    for (Product* product : products.getProducts()) {
+        product->setStockAmount(1);
+        CHECK(cart.addProductToCart(product, 1));
+    }
+    cart.checkout();
+    std::ostringstream checkoutJson;
+    Trace::WriteChromeJson(checkoutJson);
+    CHECK(checkoutJson.str().find("{\"name\":\"Orders::addOrders\",\"ph\":\"X\"") != std::string::npos);
+    CHECK(checkoutJson.str().find("{\"name\":\"Orders::addOrder\",\"ph\":\"X\"") != std::string::npos);
+    g_Orders.archiveOrders(0);
+}
+
+static void testRandom() {
+    Random::Xoshiro256 first(42, 0);
+    Random::Xoshiro256 second(42, 0);
+    Random::Xoshiro256 otherStream(42, 1);
+    bool same = true;
+    bool differs = false;
+    for (int i = 0; i < 1000; i++) {
+        uint64_t value = first.next();
+        same = same && value == second.next();
+        differs = differs || value != otherStream.next();
+    }
+    CHECK(same);
+    CHECK(differs);
+
+    // Lemire's method must stay below the range for every range, including
+    // the ones where the rejection threshold is largest.
+    Random::Xoshiro256 generator(7, 0);
+    const uint32_t ranges[] = {1, 2, 3, 7, 100, 1000000007u, (1u << 31) + 1, UINT32_MAX};
+    for (uint32_t range : ranges) {
+        bool inRange = true;
+        for (int i = 0; i < 20000; i++) {
+            inRange = inRange && Random::Bounded(generator, range) < range;
+        }
+        CHECK(inRange);
+    }
+
+    // Small ranges are hit evenly.
+    const int draws = 70000;
+    int counts[7] = {};
+    for (int i = 0; i < draws; i++) {
+        counts[Random::Bounded(generator, 7)]++;
+    }
+    for (int count : counts) {
+        CHECK(count > draws / 7 * 9 / 10 && count < draws / 7 * 11 / 10);
+    }
+
+    // Gen is inclusive at both ends, also for negative and full-width ranges.
+    bool sawMin = false;
+    bool sawMax = false;
+    bool genInRange = true;
+    for (int i = 0; i < 10000; i++) {
+        int32_t value = Random::Gen(generator, -3, 3);
+        genInRange = genInRange && value >= -3 && value <= 3;
+        sawMin = sawMin || value == -3;
+        sawMax = sawMax || value == 3;
+    }
+    CHECK(genInRange);
+    CHECK(sawMin && sawMax);
+    CHECK_EQ(Random::Gen(generator, 5, 5), 5);
+    bool fullRangeVaries = false;
+    int32_t previous = Random::Gen(generator, INT32_MIN, INT32_MAX);
+    for (int i = 0; i < 10; i++) {
+        int32_t value = Random::Gen(generator, INT32_MIN, INT32_MAX);
+        fullRangeVaries = fullRangeVaries || value != previous;
+    }
+    CHECK(fullRangeVaries);
+
+    std::vector<int32_t> ints(10000);
+    Random::Fill(ints.data(), ints.size(), 10, 100);
+    CHECK(std::all_of(ints.begin(), ints.end(), [](int32_t value) { return value >= 10 && value <= 100; }));
+    std::vector<double> doubles(10000);
+    Random::Fill(doubles.data(), doubles.size());
+    CHECK(std::all_of(doubles.begin(), doubles.end(), [](double value) { return value >= 0.0 && value < 1.0; }));
+
+    // A fixed seed and stream replay the same draws.
+    auto draw = []() {
+        Random::SetSeed(9);
+        Random::SetThreadStream(3);
+        std::vector<int32_t> values(64);
+        for (int32_t& value : values) {
+            value = Random::Gen(0, 1 << 30);
+        }
+        return values;
+    };
+    CHECK(draw() == draw());
+}
+
+static bool sameEvents(const std::vector<ReplayEvent>& a, const std::vector<ReplayEvent>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        bool hasText = !a[i].text.empty() || !b[i].text.empty();
+        if (a[i].type != b[i].type || a[i].a != b[i].a || a[i].b != b[i].b || (hasText && a[i].text != b[i].text)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void testReplayLog() {
+    std::vector<ReplayEvent> events = ReplayLog::Generate(500, 1000, 3);
+    CHECK_EQ(events.size(), (size_t)501);
+    CHECK(events.front().type == ReplayEventType::CATALOG);
+    CHECK(sameEvents(events, ReplayLog::Generate(500, 1000, 3)));
+
+    ReplayEvent fuzzy;
+    fuzzy.type = ReplayEventType::FUZZY_SEARCH;
+    fuzzy.text = "banan split";
+    ReplayEvent addBatch;
+    addBatch.type = ReplayEventType::ADD_BATCH;
+    addBatch.text = "1:2,30:4";
+    ReplayEvent removeBatch;
+    removeBatch.type = ReplayEventType::REMOVE_BATCH;
+    removeBatch.text = "5,6";
+    ReplayEvent sort;
+    sort.type = ReplayEventType::SORT;
+    sort.a = (int32_t)SortType::STOCK_AMOUNT;
+    sort.b = (int32_t)SortOrder::DESCENDING;
+    events.insert(events.end(), {fuzzy, addBatch, removeBatch, sort});
+
+    TempFile text("replay.txt");
+    TempFile binary("replay.bin");
+    CHECK(ReplayLog::SaveText(text.path(), events));
+    CHECK(ReplayLog::SaveBinary(binary.path(), events));
+
+    for (const TempFile* file : {&text, &binary}) {
+        std::vector<ReplayEvent> loaded;
+        std::string error;
+        CHECK(ReplayLog::Load(file->path(), loaded, error));
+        CHECK(error.empty());
+        CHECK(sameEvents(events, loaded));
+    }
+
+    // Comments and blank lines are skipped.
+    TempFile commented("commented.txt");
+    commented.write("# header\n\ncatalog 10\nadd 1 2\n");
+    std::vector<ReplayEvent> loaded;
+    std::string error;
+    CHECK(ReplayLog::Load(commented.path(), loaded, error));
+    CHECK_EQ(loaded.size(), (size_t)2);
+
+    const char* invalid[] = {
+        "sort price sideways\n",
+        "sort weight asc\n",
+        "add 1 x\n",
+        "add 1\n",
+        "add 1 2 3\n",
+        "catalog -5\n",
+        "add-batch 1:2,\n",
+        "add-batch 1,2\n",
+        "remove-batch 1,x\n",
+        "remove-order 0\n",
+        "explode\n",
+    };
+    for (const char* contents : invalid) {
+        TempFile bad("bad.txt");
+        bad.write(std::string("browse\n") + contents);
+        std::vector<ReplayEvent> rejected;
+        std::string reason;
+        bool ok = ReplayLog::Load(bad.path(), rejected, reason);
+        CHECK(!ok);
+        CHECK(reason.rfind("line 2: ", 0) == 0);
+        if (ok) {
+            std::cout << "  accepted: " << contents;
+        }
+    }
+
+    // Binary records go through the same validation.
+    ReplayEvent badSort;
+    badSort.type = ReplayEventType::SORT;
+    badSort.a = 7;
+    TempFile badBinary("bad.bin");
+    CHECK(ReplayLog::SaveBinary(badBinary.path(), {badSort}));
+    loaded.clear();
+    CHECK(!ReplayLog::Load(badBinary.path(), loaded, error));
+    CHECK(error.rfind("record 1: ", 0) == 0);
+    CHECK(!ReplayLog::SaveText(text.path(), {badSort}));
+
+    // remove-order names the order the log placed with that ID, not
+    // whichever order is at that position when the log is replayed.
+    if (g_ProductManager.getProducts().empty()) {
+        g_ProductManager.initDefaults();
+    }
+    std::vector<ReplayEvent> script;
+    for (int productID : {1, 2, 3}) {
+        ReplayEvent add;
+        add.type = ReplayEventType::ADD_TO_CART;
+        add.a = productID;
+        add.b = 1;
+        ReplayEvent checkout;
+        checkout.type = ReplayEventType::CHECKOUT;
+        script.insert(script.end(), {add, checkout});
+    }
+    ReplayEvent removeOrder;
+    removeOrder.type = ReplayEventType::REMOVE_ORDER;
+    removeOrder.a = 2;
+    script.insert(script.end(), {removeOrder, removeOrder});
+
+    size_t ordersBefore = (size_t)g_Orders.size();
+    ShoppingCart cart;
+    ReplayDriver driver(cart);
+    driver.run(script);
+    std::vector<int> productIDs;
+    g_Orders.forEachOrder([&productIDs](Order* order) {
+        productIDs.push_back(order->getProductID());
+    });
+    CHECK_EQ(productIDs.size(), ordersBefore + 2);
+    CHECK(productIDs.size() >= 2 && productIDs[productIDs.size() - 2] == 1 && productIDs.back() == 3);
+    g_Orders.archiveOrders(0);
+}
+
+static std::string readAvailable(int fd) {
+    std::string data;
+    char buffer[4096];
+    for (;;) {
+        ssize_t count = ::read(fd, buffer, sizeof(buffer));
+        if (count <= 0) {
+            break;
+        }
+        data.append(buffer, (size_t)count);
+    }
+    return data;
+}
+
+static void testTerminalFrames() {
+    FrameBuffer frameBuffer;
+    CHECK(frameBuffer.empty());
+    frameBuffer.stream() << "abc" << 42 << '\n';
+    CHECK_EQ(frameBuffer.str(), std::string("abc42\n"));
+    frameBuffer.clear();
+    CHECK(frameBuffer.empty());
+
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    Terminal terminal;
+    terminal.setOutput(fds[1]);
+    terminal.setTerminalRows(50);
+    terminal.setDiffEnabled(true);
+
+    // The first frame has nothing to diff against and is drawn in full.
+    terminal.beginFrame() << "a\nb\nc\n";
+    terminal.flush();
+    CHECK_EQ(readAvailable(fds[0]), std::string("\033[2J\033[1;1Ha\nb\nc\n"));
+
+    // Only the changed line is redrawn, then the cursor goes below the frame.
+    terminal.beginFrame() << "a\nX\nc\n";
+    terminal.flush();
+    CHECK_EQ(readAvailable(fds[0]), std::string("\033[2;1HX\033[K\033[4;1H\033[J"));
+
+    // A shorter frame clears what the old one left below it.
+    terminal.beginFrame() << "a\n";
+    terminal.flush();
+    CHECK_EQ(readAvailable(fds[0]), std::string("\033[2;1H\033[J"));
+
+    // An unchanged frame writes no text at all.
+    terminal.beginFrame() << "a\n";
+    terminal.flush();
+    CHECK_EQ(readAvailable(fds[0]), std::string("\033[2;1H\033[J"));
+
+    CHECK_EQ(terminal.getStats().frames, (uint64_t)4);
+    CHECK_EQ(terminal.getStats().linesRedrawn, (uint64_t)4);
+    CHECK_EQ(terminal.getStats().writeCalls, (uint64_t)4);
+
+    // Frames taller than the terminal are never diffed.
+    terminal.setTerminalRows(2);
+    terminal.beginFrame() << "a\nb\nc\n";
+    terminal.flush();
+    CHECK_EQ(readAvailable(fds[0]), std::string("\033[2J\033[1;1Ha\nb\nc\n"));
+
+    // Without diffing every frame is a full redraw.
+    Terminal plain;
+    plain.setOutput(fds[1]);
+    plain.beginFrame() << "a\n";
+    plain.flush();
+    plain.beginFrame() << "a\n";
+    plain.flush();
+    CHECK_EQ(readAvailable(fds[0]), std::string("\033[2J\033[1;1Ha\n\033[2J\033[1;1Ha\n"));
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void testIncrementalSort() {
+    ProductManager products;
+    addNumberedProducts(products, 40000);
+    std::set<Product*> before(products.getProducts().begin(), products.getProducts().end());
+
+    IncrementalSort sort(products, SortType::PRICE, SortOrder::DESCENDING);
+    int steps = 0;
+    int progress = 0;
+    bool monotonic = true;
+    while (sort.step()) {
+        steps++;
+        monotonic = monotonic && sort.getProgressPercent() >= progress;
+        progress = sort.getProgressPercent();
+    }
+    CHECK(monotonic);
+    CHECK(steps > 3);
+    CHECK_EQ(sort.getProgressPercent(), 100);
+    CHECK(sort.wasApplied());
+    CHECK(isSorted(products.getProducts(), SortType::PRICE, SortOrder::DESCENDING));
+    CHECK(std::set<Product*>(products.getProducts().begin(), products.getProducts().end()) == before);
+
+    // Agrees with the foreground sort.
+    std::vector<int> incremental;
+    for (Product* product : products.getProducts()) {
+        incremental.push_back(product->getPrice());
+    }
+    products.sortProducts(SortType::PRICE, SortOrder::DESCENDING);
+    std::vector<int> foreground;
+    for (Product* product : products.getProducts()) {
+        foreground.push_back(product->getPrice());
+    }
+    CHECK(incremental == foreground);
+
+    // A catalog change while sorting discards the result.
+    std::vector<Product*> order(products.getProducts().begin(), products.getProducts().end());
+    IncrementalSort stale(products, SortType::ID, SortOrder::ASCENDING);
+    stale.step();
+    products.getProducts()[0]->setName("Renamed");
+    while (stale.step()) {
+    }
+    CHECK(!stale.wasApplied());
+    CHECK(std::equal(order.begin(), order.end(), products.getProducts().begin(), products.getProducts().end()));
+
+    CHECK(!products.setProductOrder(order, products.getCatalogGeneration() - 1));
+    std::reverse(order.begin(), order.end());
+    CHECK(products.setProductOrder(order, products.getCatalogGeneration()));
+    CHECK(products.getProducts()[0] == order[0]);
+    order.pop_back();
+    CHECK(!products.setProductOrder(order, products.getCatalogGeneration()));
+}
+
+static void testEventLoop() {
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    EventLoop loop(fds[0]);
+    std::vector<std::string> events;
+
+    // Added in reverse deadline order; each fires once and cancels itself.
+    int slow = 0;
+    int medium = 0;
+    int fast = 0;
+    int victim = 0;
+    slow = loop.addTimer(std::chrono::milliseconds(150), [&]() {
+        events.push_back("slow");
+        loop.cancelTimer(slow);
+        ::write(fds[1], "done\n", 5);
+    });
+    medium = loop.addTimer(std::chrono::milliseconds(100), [&]() {
+        events.push_back("medium");
+        loop.cancelTimer(medium);
+        loop.cancelTimer(victim);
+    });
+    fast = loop.addTimer(std::chrono::milliseconds(50), [&]() {
+        events.push_back("fast");
+        loop.cancelTimer(fast);
+    });
+    // Cancelled by medium before it is due, even when both come due together.
+    victim = loop.addTimer(std::chrono::milliseconds(120), [&]() {
+        events.push_back("victim");
+    });
+    int cancelled = loop.addTimer(std::chrono::milliseconds(1), [&]() {
+        events.push_back("cancelled");
+    });
+    loop.cancelTimer(cancelled);
+
+    loop.post([&]() {
+        events.push_back("task");
+    });
+    int slices = 0;
+    loop.addJob([&]() {
+        return ++slices < 3;
+    });
+
+    std::string line;
+    CHECK(loop.waitForLine(line));
+    CHECK_EQ(line, std::string("done"));
+    CHECK(events == std::vector<std::string>({"task", "fast", "medium", "slow"}));
+    CHECK_EQ(slices, 3);
+    CHECK(!loop.hasPendingWork());
+
+    // A trailing partial line is returned once the input ends.
+    ::write(fds[1], "partial", 7);
+    close(fds[1]);
+    CHECK(loop.waitForLine(line));
+    CHECK_EQ(line, std::string("partial"));
+    CHECK(!loop.waitForLine(line));
+    CHECK(loop.isInputClosed());
+
+    close(fds[0]);
+}
+
+static void testSearchCache() {
+    // One shard with room for two entries, so eviction order is exact.
+    SearchCache cache(2, 1);
+    std::vector<int> ids;
+    cache.insert("a", 1, {1});
+    cache.insert("b", 1, {2});
+    CHECK(cache.lookup("a", 1, ids));
+    cache.insert("c", 1, {3});
+
+    CHECK(!cache.lookup("b", 1, ids));
+    CHECK(cache.lookup("a", 1, ids));
+    CHECK(ids == std::vector<int>{1});
+    CHECK(cache.lookup("c", 1, ids));
+    CHECK(ids == std::vector<int>{3});
+
+    SearchCache::Stats stats = cache.getStats();
+    CHECK_EQ(stats.evictions, (uint64_t)1);
+    CHECK_EQ(stats.misses, (uint64_t)1);
+    CHECK_EQ(stats.hits, (uint64_t)3);
+
+    // Entries from an older catalog generation read as stale misses until
+    // they are refreshed.
+    CHECK(!cache.lookup("a", 2, ids));
+    CHECK_EQ(cache.getStats().stale, (uint64_t)1);
+    cache.insert("a", 2, {4});
+    CHECK(cache.lookup("a", 2, ids));
+    CHECK(ids == std::vector<int>{4});
+    CHECK_EQ(cache.getStats().evictions, (uint64_t)1);
+
+    cache.clear();
+    CHECK(!cache.lookup("a", 2, ids));
+
+    // Through ProductManager: a rename invalidates cached results.
+    ProductManager products;
+    products.initDefaults();
+    CHECK_EQ(products.getProductsWithString("an").size(), (size_t)2);
+    products.resetSearchCacheStats();
+    CHECK_EQ(products.getProductsWithString("an").size(), (size_t)2);
+    CHECK_EQ(products.getSearchCacheStats().hits, (uint64_t)1);
+
+    products.getProduct(1)->setName("Mango");
+    std::vector<Product*> matches = products.getProductsWithString("an");
+    CHECK_EQ(matches.size(), (size_t)3);
+    CHECK_EQ(products.getSearchCacheStats().stale, (uint64_t)1);
+    CHECK_EQ(products.getProductByName("Mang")->getID(), 1);
+
+    // Sorting changes the order of the results, so it invalidates too.
+    products.sortProducts(SortType::PRICE, SortOrder::DESCENDING);
+    matches = products.getProductsWithString("an");
+    CHECK_EQ(matches.size(), (size_t)3);
+    CHECK_EQ(matches.front()->getName(), std::string_view("Orange"));
+}
+
+// Textbook dynamic-programming Levenshtein distance, case-insensitive.
+static int referenceDistance(std::string_view a, std::string_view b) {
+    std::vector<int> row(b.size() + 1);
+    for (size_t j = 0; j <= b.size(); j++) {
+        row[j] = (int)j;
+    }
+    for (size_t i = 1; i <= a.size(); i++) {
+        int diagonal = row[0];
+        row[0] = (int)i;
+        for (size_t j = 1; j <= b.size(); j++) {
+            int above = row[j];
+            bool same = std::tolower((uint8_t)a[i - 1]) == std::tolower((uint8_t)b[j - 1]);
+            row[j] = std::min({row[j] + 1, row[j - 1] + 1, diagonal + (same ? 0 : 1)});
+            diagonal = above;
+        }
+    }
+    return row[b.size()];
+}
+
+static int fuzzyDistance(std::string_view pattern, std::string_view text, int maxDistance = 100) {
+    return FuzzyMatcher(pattern).distance(text.data(), text.size(), maxDistance);
+}
+
+static void testFuzzySearch() {
+    CHECK_EQ(fuzzyDistance("kitten", "sitting"), 3);
+    CHECK_EQ(fuzzyDistance("flaw", "lawn"), 2);
+    CHECK_EQ(fuzzyDistance("Apple", "apple"), 0);
+    CHECK_EQ(fuzzyDistance("", "abc"), 3);
+    CHECK_EQ(fuzzyDistance("abc", ""), 3);
+    // Past maxDistance the result is just maxDistance + 1.
+    CHECK_EQ(fuzzyDistance("kitten", "sitting", 1), 2);
+
+    Random::Xoshiro256 generator(5, 0);
+    auto randomWord = [&generator](size_t maxLength) {
+        std::string word(Random::Bounded(generator, (uint32_t)maxLength + 1), ' ');
+        for (char& c : word) {
+            c = (char)('a' + Random::Bounded(generator, 4));
+        }
+        return word;
+    };
+    bool matchesReference = true;
+    for (int i = 0; i < 2000; i++) {
+        std::string pattern = randomWord(i % 10 == 0 ? 64 : 12);
+        std::string text = randomWord(i % 10 == 0 ? 70 : 12);
+        int expected = referenceDistance(pattern, text);
+        int bounded = fuzzyDistance(pattern, text, 2);
+        matchesReference = matchesReference && fuzzyDistance(pattern, text) == expected &&
+            (expected <= 2 ? bounded == expected : bounded > 2);
+    }
+    CHECK(matchesReference);
+
+    ProductManager products;
+    products.initDefaults();
+    std::vector<Product*> matches = products.getProductsFuzzy("Banan");
+    CHECK(!matches.empty() && matches.front()->getName() == "Banana");
+    matches = products.getProductsFuzzy("grap");
+    CHECK(!matches.empty() && matches.front()->getName() == "Grape");
+    CHECK(products.getProductsFuzzy("xyzzy").empty());
+    CHECK(products.getProductsFuzzy("Banan", 0).empty());
+
+    // Multi-word names match on every word; renames rebuild the index.
+    products.getProduct(1)->setName("Green Mango");
+    matches = products.getProductsFuzzy("mangp");
+    CHECK(matches.size() == 1 && matches.front()->getID() == 1);
+    CHECK(products.getProductsFuzzy("aple", 1).empty());
+
+    // Results are ordered by distance, then ID, and limited.
+    matches = products.getProductsFuzzy("Grape", 5, 2);
+    CHECK_EQ(matches.size(), (size_t)2);
+    CHECK_EQ(matches.front()->getName(), std::string_view("Grape"));
+}
+
+static void testShardedCatalog() {
+    const int count = 200;
+    ProductManager plain;
+    addNumberedProducts(plain, count);
+
+    ShardedProductManager sharded(4);
+    std::vector<std::future<int>> added;
+    for (Product* product : plain.getProducts()) {
+        Product* copy = new Product(*product);
+        copy->setCatalogGeneration(nullptr);
+        added.push_back(sharded.addProduct(copy));
+    }
+    // Round-robin placement with per-shard ID strides hands out 1, 2, 3, ...
+    for (size_t i = 0; i < added.size(); i++) {
+        CHECK_EQ(added[i].get(), (int)i + 1);
+    }
+    CHECK_EQ(sharded.size(), (size_t)count);
+    CHECK_EQ(sharded.shardOf(5), (size_t)0);
+    CHECK_EQ(sharded.shardOf(6), (size_t)1);
+
+    std::optional<Product> product = sharded.getProduct(42).get();
+    CHECK(product && product->getName() == plain.getProduct(42)->getName());
+    CHECK(!sharded.getProduct(count + 1).get());
+
+    // Scatter-gather search finds the same products as the plain catalog.
+    std::vector<int> found = sharded.searchProducts("1");
+    std::vector<int> expected;
+    for (Product* match : plain.getProductsWithString("1")) {
+        expected.push_back(match->getID());
+    }
+    std::sort(found.begin(), found.end());
+    std::sort(expected.begin(), expected.end());
+    CHECK(found == expected);
+
+    // The merged sorted listing matches sorting the whole catalog.
+    const SortType sortTypes[] = {SortType::PRICE, SortType::STOCK_AMOUNT, SortType::ID};
+    for (SortType sortType : sortTypes) {
+        for (SortOrder sortOrder : {SortOrder::ASCENDING, SortOrder::DESCENDING}) {
+            std::vector<Product*> sorted(plain.getProducts().begin(), plain.getProducts().end());
+            std::sort(sorted.begin(), sorted.end(), ProductComparator{sortType, sortOrder});
+            std::vector<int> top = sharded.getSortedProductIDs(sortType, sortOrder, 25);
+            CHECK_EQ(top.size(), (size_t)25);
+            bool same = true;
+            for (size_t i = 0; i < top.size(); i++) {
+                same = same && sortKey(plain.getProduct(top[i]), sortType) == sortKey(sorted[i], sortType);
+            }
+            CHECK(same);
+        }
+    }
+
+    CHECK(sharded.setStockAmount(7, 1234).get());
+    CHECK_EQ(sharded.getProduct(7).get()->getStockAmount(), 1234);
+    CHECK(!sharded.setStockAmount(count + 10, 1).get());
+
+    // Removing a product leaves deleting it to the caller.
+    Product* removed = sharded.submit(sharded.shardOf(7), [](ProductManager& products) {
+        return products.getProduct(7);
+    }).get();
+    CHECK(sharded.removeProduct(7).get());
+    delete removed;
+    CHECK(!sharded.removeProduct(7).get());
+    CHECK(!sharded.getProduct(7).get());
+    CHECK_EQ(sharded.size(), (size_t)count - 1);
+
+    CHECK_EQ(sharded.submit(sharded.shardOf(8), [](ProductManager& products) {
+        return products.getProduct(8) != nullptr;
+    }).get(), true);
+}
+
+static void testCartBatch() {
+    ProductManager products;
+    addNumberedProducts(products, 50);
+
+    std::vector<CartLine> lines;
+    Random::Xoshiro256 generator(11, 0);
+    for (int i = 0; i < 500; i++) {
+        // IDs past the catalog, zero and negative quantities and quantities
+        // above the stock are all in the mix.
+        lines.push_back({(int)Random::Bounded(generator, 60), Random::Gen(generator, -2, 60)});
+    }
+
+    ShoppingCart perLine;
+    std::vector<CartLineStatus> expected;
+    for (const CartLine& line : lines) {
+        Product* product = products.getProduct(line.productID);
+        if (!product) {
+            expected.push_back(CartLineStatus::UNKNOWN_PRODUCT);
+        } else if (line.quantity <= 0) {
+            expected.push_back(CartLineStatus::INVALID_QUANTITY);
+        } else if (!perLine.addProductToCart(product, line.quantity)) {
+            expected.push_back(CartLineStatus::INSUFFICIENT_STOCK);
+        } else {
+            expected.push_back(CartLineStatus::OK);
+        }
+    }
+
+    ShoppingCart batched;
+    std::vector<CartLineResult> results = batched.addProductsToCart(lines, products);
+    CHECK_EQ(results.size(), lines.size());
+    bool sameResults = true;
+    std::set<CartLineStatus> statuses;
+    for (size_t i = 0; i < results.size(); i++) {
+        sameResults = sameResults && results[i].status == expected[i] && results[i].productID == lines[i].productID &&
+            results[i].quantity == lines[i].quantity;
+        statuses.insert(results[i].status);
+    }
+    CHECK(sameResults);
+    CHECK_EQ(statuses.size(), (size_t)4);
+
+    auto cartLines = [](ShoppingCart& cart) {
+        std::vector<std::pair<int, int>> contents;
+        for (Order* order : cart.getCart()) {
+            contents.push_back({order->getProductID(), order->getQuantity()});
+        }
+        return contents;
+    };
+    CHECK(cartLines(perLine) == cartLines(batched));
+    CHECK(batched.getCartSize() > 0);
+
+    // Batched removal drops the same lines as removing product by product.
+    // Both free the orders they remove, which the leak checker verifies.
+    std::vector<int> removals = {1, 2, 3, 10, 10, 49, 1000};
+    size_t before = (size_t)perLine.getCartSize();
+    for (int productID : removals) {
+        perLine.removeProductFromCart(productID);
+    }
+    size_t removed = before - (size_t)perLine.getCartSize();
+    CHECK(removed > 0);
+    CHECK_EQ(batched.removeProductsFromCart(removals), removed);
+    CHECK(cartLines(perLine) == cartLines(batched));
+
+    for (ShoppingCart* cart : {&perLine, &batched}) {
+        for (Order* order : cart->getCart()) {
+            delete order;
+        }
+        cart->clearCart();
+    }
+}
+
+static void testOrderArchive() {
+    Random::Xoshiro256 generator(13, 0);
+    std::vector<OrderArchive::Row> rows;
+    int orderID = -50;
+    for (size_t i = 0; i < 2 * OrderArchive::BLOCK_SIZE + 123; i++) {
+        // Order IDs with gaps, the second block with a constant quantity
+        // (packed at zero bits) and shipping costs needing all 32 bits.
+        orderID += 1 + (int)Random::Bounded(generator, i < OrderArchive::BLOCK_SIZE ? 1 : 1000);
+        int quantity = i / OrderArchive::BLOCK_SIZE == 1 ? 3 : Random::Gen(generator, 1, 5);
+        rows.push_back({orderID, Random::Gen(generator, 1, 300), quantity, Random::Gen(generator, INT32_MIN, INT32_MAX)});
+    }
+
+    OrderArchive archive;
+    for (const OrderArchive::Row& row : rows) {
+        archive.append(row);
+    }
+    CHECK_EQ(archive.size(), rows.size());
+    CHECK_EQ(archive.getBlockCount(), (size_t)2);
+
+    size_t index = 0;
+    bool roundTrips = true;
+    archive.forEach([&](const OrderArchive::Row& row) {
+        const OrderArchive::Row& original = rows[index++];
+        roundTrips = roundTrips && row.orderID == original.orderID && row.productID == original.productID &&
+            row.quantity == original.quantity && row.shippingCost == original.shippingCost;
+    });
+    CHECK_EQ(index, rows.size());
+    CHECK(roundTrips);
+
+    int64_t shipping = 0;
+    int64_t quantity = 0;
+    for (const OrderArchive::Row& row : rows) {
+        shipping += row.shippingCost;
+        quantity += row.quantity;
+    }
+    CHECK_EQ(archive.totalShippingCost(), shipping);
+    CHECK_EQ(archive.totalQuantity(), quantity);
+
+    for (int productID : {1, 17, 150, 300, 301}) {
+        int64_t expected = 0;
+        for (const OrderArchive::Row& row : rows) {
+            expected += row.productID == productID ? row.quantity : 0;
+        }
+        CHECK_EQ(archive.totalQuantityForProduct(productID), expected);
+    }
+
+    const std::pair<int, int> ranges[] = {{-100, -40}, {0, 500}, {rows[900].orderID, rows[1500].orderID},
+        {rows[1100].orderID, rows[1100].orderID}, {INT32_MIN, INT32_MAX}, {rows.back().orderID + 1, INT32_MAX}};
+    for (const std::pair<int, int>& range : ranges) {
+        int64_t expected = 0;
+        for (const OrderArchive::Row& row : rows) {
+            expected += row.orderID >= range.first && row.orderID <= range.second ? row.shippingCost : 0;
+        }
+        CHECK_EQ(archive.shippingCostForOrderRange(range.first, range.second), expected);
+    }
+
+    // Orders keeps the newest orders live and archives the rest.
+    Orders orders;
+    for (int i = 0; i < 3000; i++) {
+        Order* order = new Order();
+        order->setProductID(1 + i % 7);
+        order->setQuantity(1 + i % 3);
+        order->setShippingCost(10 + i % 90);
+        orders.addOrder(order);
+    }
+    CHECK_EQ(orders.archiveOrders(500), (size_t)2500);
+    CHECK_EQ(orders.archiveOrders(500), (size_t)0);
+    CHECK_EQ(orders.size(), 500);
+    CHECK_EQ(orders.getOrder(0)->getOrderID(), 2501);
+    CHECK_EQ(orders.getArchive().size(), (size_t)2500);
+
+    // Only live orders can be removed, and they are found by order ID.
+    CHECK(!orders.removeOrder(100));
+    CHECK(!orders.removeOrder(3001));
+    CHECK(orders.removeOrder(2600));
+    CHECK(!orders.removeOrder(2600));
+    CHECK_EQ(orders.size(), 499);
+    CHECK_EQ(orders.getOrder(99)->getOrderID(), 2601);
+    int64_t archivedShipping = 0;
+    for (int i = 0; i < 2500; i++) {
+        archivedShipping += 10 + i % 90;
+    }
+    CHECK_EQ(orders.getArchive().totalShippingCost(), archivedShipping);
+    orders.archiveOrders(0);
+}
+
+template <typename T>
+static T readValue(const std::string& data, size_t offset) {
+    T value;
+    std::memcpy(&value, data.data() + offset, sizeof(T));
+    return value;
+}
+
+static void testColumnarExport() {
+    ProductManager products;
+    products.initDefaults();
+
+    TempFile catalog("catalog.col");
+    CHECK(exportCatalogColumnar(catalog.path(), products));
+    std::string data = catalog.read();
+    CHECK(data.size() % 8 == 0);
+    CHECK_EQ(data.substr(0, 8), std::string("CDCOL001"));
+    CHECK_EQ(readValue<uint32_t>(data, 8), (uint32_t)5);
+
+    // Footer: batch offsets, batch count, total rows, end magic.
+    CHECK_EQ(data.substr(data.size() - 8), std::string("CDCOLEND"));
+    CHECK_EQ(readValue<uint64_t>(data, data.size() - 16), (uint64_t)5);
+    CHECK_EQ(readValue<uint64_t>(data, data.size() - 24), (uint64_t)1);
+    uint64_t batch = readValue<uint64_t>(data, data.size() - 32);
+    CHECK_EQ(readValue<uint32_t>(data, batch), (uint32_t)5);
+
+    // The first column holds the IDs, the second the names as offsets plus
+    // the string data.
+    bool ids = true;
+    for (uint32_t i = 0; i < 5; i++) {
+        ids = ids && readValue<int32_t>(data, batch + 8 + 4 * i) == (int32_t)i + 1;
+    }
+    CHECK(ids);
+    size_t names = batch + 8 + 24;
+    CHECK_EQ(readValue<int32_t>(data, names), 0);
+    CHECK_EQ(readValue<int32_t>(data, names + 4), 5);
+    CHECK_EQ(data.substr(names + 24, 11), std::string("AppleBanana"));
+
+    // Rows are split into batches of the configured size.
+    TempFile small("small.col");
+    {
+        ColumnarWriter writer(2);
+        CHECK(writer.open(small.path(), {{"value", ColumnarWriter::ColumnType::INT32}}));
+        for (int i = 0; i < 5; i++) {
+            writer.appendInt(0, i * 10);
+            CHECK(writer.endRow());
+        }
+        CHECK(writer.close());
+        CHECK_EQ(writer.getBytesWritten(), (uint64_t)std::filesystem::file_size(small.path()));
+    }
+    data = small.read();
+    uint64_t batches = readValue<uint64_t>(data, data.size() - 24);
+    CHECK_EQ(batches, (uint64_t)3);
+    CHECK_EQ(readValue<uint64_t>(data, data.size() - 16), (uint64_t)5);
+    uint64_t lastBatch = readValue<uint64_t>(data, data.size() - 32);
+    CHECK_EQ(readValue<uint32_t>(data, lastBatch), (uint32_t)1);
+    CHECK_EQ(readValue<int32_t>(data, lastBatch + 8), 40);
+}
+
+static void testAllocationFreeRows() {
+    ProductManager products;
+    products.initDefaults();
+
+    // Walking the catalog hands out views, never copies.
+    uint64_t allocations = AllocationCounter::Count();
+    size_t nameLength = 0;
+    for (Product* product : products.getProducts()) {
+        nameLength += product->getName().size() + product->getDescription().size();
+    }
+    CHECK_EQ(AllocationCounter::Count() - allocations, (uint64_t)0);
+    CHECK(nameLength > 0);
+
+    // string_view rows are built in place without touching the heap.
+    Tabulator<int, std::string_view> tabulator({"ID", "Name"});
+    tabulator.setColumnFormat({ColumnFormat::AUTO, ColumnFormat::AUTO});
+    tabulator.reserve(100);
+    allocations = AllocationCounter::Count();
+    for (int i = 0; i < 100; i++) {
+        tabulator.emplaceRow(i, "row");
+    }
+    CHECK_EQ(AllocationCounter::Count() - allocations, (uint64_t)0);
+
+    // Once the frame buffer has grown, rendering the same frame again does
+    // not allocate either.
+    FrameBuffer frameBuffer;
+    tabulator.print(frameBuffer.stream());
+    std::string expected = frameBuffer.str();
+    frameBuffer.clear();
+    allocations = AllocationCounter::Count();
+    frameBuffer.stream() << expected;
+    CHECK_EQ(AllocationCounter::Count() - allocations, (uint64_t)0);
+    CHECK(frameBuffer.str() == expected);
+}
+
+static void testSessionProtocol() {
+    ProductManager& products = g_ProductManager;
+    if (products.getProducts().empty()) {
+        products.initDefaults();
+    }
+    size_t ordersBefore = (size_t)g_Orders.size();
+
+    Session session;
+    CHECK_EQ(session.handle("CATALOG"), "OK " + std::to_string(products.getProducts().size()));
+    CHECK_EQ(session.handle("SEARCH an"), "OK " + std::to_string(products.getProductsWithString("an").size()));
+
+    CHECK_EQ(session.handle("ADD 1 2"), std::string("OK"));
+    CHECK_EQ(session.handle("ADD 1"), std::string("ERR usage: ADD <product id> <quantity>"));
+    CHECK_EQ(session.handle("ADD 1 2 3"), std::string("ERR usage: ADD <product id> <quantity>"));
+    CHECK_EQ(session.handle("ADD 1  2"), std::string("ERR usage: ADD <product id> <quantity>"));
+    CHECK_EQ(session.handle("ADD x 2"), std::string("ERR usage: ADD <product id> <quantity>"));
+    CHECK_EQ(session.handle("ADD 999999 1"), std::string("ERR unknown product"));
+    CHECK_EQ(session.handle("ADD 1 0"), std::string("ERR invalid quantity"));
+    CHECK_EQ(session.handle("ADD 1 1000000"), std::string("ERR insufficient stock"));
+
+    int price = products.getProduct(1)->getPrice();
+    CHECK_EQ(session.handle("CART"), "OK 1 " + std::to_string(2 * price));
+
+    CHECK_EQ(session.handle("REMOVE"), std::string("ERR usage: REMOVE <product id>"));
+    CHECK_EQ(session.handle("REMOVE 1x"), std::string("ERR usage: REMOVE <product id>"));
+    CHECK_EQ(session.handle("REMOVE 1"), std::string("OK"));
+    CHECK_EQ(session.handle("CART"), std::string("OK 0 0"));
+    CHECK_EQ(session.handle("CHECKOUT"), std::string("ERR empty cart"));
+
+    CHECK_EQ(session.handle("ADD 1 3"), std::string("OK"));
+    CHECK_EQ(session.handle("CHECKOUT"), "OK 1 " + std::to_string(3 * price));
+    CHECK_EQ((size_t)g_Orders.size(), ordersBefore + 1);
+    CHECK_EQ(g_Orders.archiveOrders(0), ordersBefore + 1);
+    CHECK_EQ(session.handle("CART"), std::string("OK 0 0"));
+
+    CHECK_EQ(session.handle("QUIT"), std::string("BYE"));
+    CHECK_EQ(session.handle("DANCE"), std::string("ERR unknown command"));
+}
+
+static void testScheduler() {
+    TaskScheduler::Options options;
+    options.threads = 4;
+    g_TaskScheduler.configure(options);
+    CHECK_EQ(g_TaskScheduler.getThreadCount(), 4u);
+    CHECK(!g_TaskScheduler.onWorker());
+
+    Random::Xoshiro256 generator(17, 0);
+    std::vector<int32_t> values(300000);
+    for (int32_t& value : values) {
+        value = Random::Gen(generator, -1000000, 1000000);
+    }
+
+    std::vector<int32_t> sorted = values;
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<int32_t> parallel = values;
+    Parallel::Sort(parallel.begin(), parallel.end(), std::less<int32_t>(), 1 << 12);
+    CHECK(parallel == sorted);
+    parallel = values;
+    Parallel::Sort(parallel.begin(), parallel.end(), std::greater<int32_t>(), 1000);
+    CHECK(std::equal(parallel.begin(), parallel.end(), sorted.rbegin()));
+
+    int64_t serialSum = 0;
+    for (int32_t value : values) {
+        serialSum += value;
+    }
+    int64_t sum = Parallel::Reduce(0, values.size(), 1000, (int64_t)0, [&values](size_t begin, size_t end) {
+        int64_t local = 0;
+        for (size_t i = begin; i < end; i++) {
+            local += values[i];
+        }
+        return local;
+    }, std::plus<int64_t>());
+    CHECK_EQ(sum, serialSum);
+    CHECK_EQ(Parallel::Reduce(5, 5, 1, (int64_t)-1, [](size_t, size_t) { return (int64_t)0; }, std::plus<int64_t>()), (int64_t)-1);
+
+    // Reduce combines chunks in order.
+    std::string concatenated = Parallel::Reduce(0, 26, 1, std::string(), [](size_t begin, size_t end) {
+        std::string text;
+        for (size_t i = begin; i < end; i++) {
+            text += (char)('a' + i);
+        }
+        return text;
+    }, [](std::string left, const std::string& right) {
+        return left + right;
+    });
+    CHECK_EQ(concatenated, std::string("abcdefghijklmnopqrstuvwxyz"));
+
+    std::vector<std::atomic<int>> visits(100000);
+    std::atomic<bool> chunksFit { true };
+    Parallel::For(0, visits.size(), 7, [&](size_t begin, size_t end) {
+        if (end - begin > 7) {
+            chunksFit = false;
+        }
+        for (size_t i = begin; i < end; i++) {
+            visits[i].fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+    CHECK(chunksFit.load());
+    CHECK(std::all_of(visits.begin(), visits.end(), [](const std::atomic<int>& count) { return count.load() == 1; }));
+
+    std::atomic<int> both { 0 };
+    Parallel::Invoke([&both]() { both += 1; }, [&both]() { both += 2; });
+    CHECK_EQ(both.load(), 3);
+
+    // Nested parallel calls from a worker run on the same pool.
+    std::atomic<bool> nestedOnWorker { true };
+    Parallel::For(0, 16, 1, [&](size_t, size_t) {
+        nestedOnWorker = nestedOnWorker && g_TaskScheduler.onWorker();
+        Parallel::For(0, 64, 4, [&](size_t, size_t) {
+            nestedOnWorker = nestedOnWorker && g_TaskScheduler.onWorker();
+        });
+    });
+    CHECK(nestedOnWorker.load());
+
+    // Large catalogs are sorted on the pool.
+    ProductManager products;
+    addNumberedProducts(products, 70000);
+    const SortType sortTypes[] = {SortType::PRICE, SortType::STOCK_AMOUNT, SortType::ID};
+    for (SortType sortType : sortTypes) {
+        for (SortOrder sortOrder : {SortOrder::ASCENDING, SortOrder::DESCENDING}) {
+            products.sortProducts(sortType, sortOrder);
+            CHECK(isSorted(products.getProducts(), sortType, sortOrder));
+            CHECK_EQ(products.getProducts().size(), (size_t)70000);
+        }
+    }
+}
+
+static void testTabulatorWindow() {
+    const size_t rowCount = 300;
+    std::vector<std::string> names;
+    for (size_t i = 0; i < rowCount; i++) {
+        names.push_back(std::string(1 + i % 13, (char)('a' + i % 26)));
+    }
+    // One row far wider than the rest, outside every sample below.
+    names[151] = std::string(40, 'w');
+    auto row = [&names](size_t i) {
+        return std::make_tuple((int)i * 37, std::string_view(names[i]), (double)i / 8);
+    };
+
+    typedef Tabulator<int, std::string_view, double> Table;
+    auto makeTable = []() {
+        Table table({"Number", "Name", "Ratio"});
+        table.setColumnFormat({ColumnFormat::AUTO, ColumnFormat::AUTO, ColumnFormat::FIXED});
+        table.setColumnPrecision({0, 0, 2});
+        return table;
+    };
+
+    Table stored = makeTable();
+    for (size_t i = 0; i < rowCount; i++) {
+        stored.emplaceRow(row(i));
+    }
+    std::ostringstream printed;
+    stored.print(printed);
+
+    // The whole table through a row source prints exactly what print() does.
+    std::ostringstream window;
+    makeTable().printWindow(window, row, rowCount);
+    CHECK(window.str() == printed.str());
+
+    // With every row sampled, a window prints the same lines as print()
+    // minus the rows outside it.
+    std::vector<std::string> all = splitLines(printed.str());
+    CHECK_EQ(all.size(), rowCount + 4);
+    std::ostringstream page;
+    makeTable().printWindow(page, row, rowCount, 100, 20, rowCount);
+    std::vector<std::string> expected(all.begin(), all.begin() + 3);
+    expected.insert(expected.end(), all.begin() + 3 + 100, all.begin() + 3 + 120);
+    expected.push_back(all.back());
+    CHECK(splitLines(page.str()) == expected);
+
+    // With a sparse sample the page still shows exactly its rows, and a cell
+    // wider than every sampled one widens its column instead of being cut.
+    std::ostringstream sparse;
+    makeTable().printWindow(sparse, row, rowCount, 150, 5, 10);
+    std::vector<std::string> lines = splitLines(sparse.str());
+    CHECK_EQ(lines.size(), (size_t)5 + 4);
+    CHECK(lines[4].find(names[151]) != std::string::npos);
+    CHECK(std::all_of(lines.begin(), lines.end(), [&lines](const std::string& line) { return line.size() == lines[0].size(); }));
+
+    std::ostringstream narrow;
+    makeTable().printWindow(narrow, row, rowCount, 10, 5, 10);
+    CHECK(splitLines(narrow.str())[0].size() < lines[0].size());
+
+    // Windows past the end are clamped.
+    std::ostringstream tail;
+    makeTable().printWindow(tail, row, rowCount, rowCount - 2, 50);
+    CHECK_EQ(splitLines(tail.str()).size(), (size_t)2 + 4);
+    std::ostringstream empty;
+    makeTable().printWindow(empty, row, rowCount, rowCount + 10, 5);
+    CHECK_EQ(splitLines(empty.str()).size(), (size_t)4);
+
+    // The catalog screen pages through the product list the same way.
+    std::ostringstream catalogPage;
+    if (g_ProductManager.getProducts().empty()) {
+        g_ProductManager.initDefaults();
+    }
+    printProductCatalogPage(catalogPage, 1, 2);
+    std::vector<std::string> catalogLines = splitLines(catalogPage.str());
+    CHECK_EQ(catalogLines.size(), (size_t)1 + 2 + 4);
+    CHECK_EQ(catalogLines[0], "Product Catalog (" + std::to_string(g_ProductManager.getProducts().size()) + ", showing 2-3)");
+    CHECK(catalogLines[4].find("Banana") != std::string::npos);
+    CHECK(catalogLines[5].find("Orange") != std::string::npos);
+}
+
+struct TestCase {
+    const char* name;
+    void (*run)();
+};
+
+static const TestCase g_Tests[] = {
+    {"trace-ring", testTraceRing},
+    {"random", testRandom},
+    {"replay-log", testReplayLog},
+    {"terminal-frames", testTerminalFrames},
+    {"incremental-sort", testIncrementalSort},
+    {"event-loop", testEventLoop},
+    {"search-cache", testSearchCache},
+    {"fuzzy-search", testFuzzySearch},
+    {"sharded-catalog", testShardedCatalog},
+    {"cart-batch", testCartBatch},
+    {"order-archive", testOrderArchive},
+    {"columnar-export", testColumnarExport},
+    {"allocation-free-rows", testAllocationFreeRows},
+    {"session-protocol", testSessionProtocol},
+    {"scheduler", testScheduler},
+    {"tabulator-window", testTabulatorWindow},
+};
+
+int main(int argc, char** argv) {
+    std::vector<const TestCase*> selected;
+    for (int i = 1; i < argc; i++) {
+        auto found = std::find_if(std::begin(g_Tests), std::end(g_Tests), [&](const TestCase& test) {
+            return std::string_view(test.name) == argv[i];
+        });
+        if (found == std::end(g_Tests)) {
+            std::cout << "Unknown test '" << argv[i] << "'\n";
+            return 2;
+        }
+        selected.push_back(found);
+    }
+    if (selected.empty()) {
+        for (const TestCase& test : g_Tests) {
+            selected.push_back(&test);
+        }
+    }
+
+    for (const TestCase* test : selected) {
+        int failures = g_Failures;
+        test->run();
+        std::cout << (g_Failures == failures ? "PASS " : "FAIL ") << test->name << "\n";
+    }
+    return g_Failures == 0 ? 0 : 1;
+}